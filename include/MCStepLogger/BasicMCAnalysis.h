@@ -69,8 +69,15 @@ class BasicMCAnalysis : public MCAnalysis
   void analyze(const std::vector<StepInfo>* const steps, const std::vector<MagCallInfo>* const magCalls) override;
   /// custom finalizations of produced histograms
   void finalize() override;
+  /// for parallel workers
+  MCAnalysis* clone() const override { return new BasicMCAnalysis(); }
+  /// add the helpers of a clone
+  void merge(const MCAnalysis& other) override;
 
  private:
+  /// set the entries of the step and track histograms to the totals over all events
+  void setEntries();
+
   // number of events
   TH1D* histNEvents;
   // number of tracks over all events
@@ -89,6 +96,10 @@ class BasicMCAnalysis : public MCAnalysis
   TH1D* histNStepsPerVolPerEvent;
   // accumulated number of steps per module/region
   TH1D* histNStepsPerMod;
+  // accumulated number of steps per medium
+  TH1D* histNStepsPerMed;
+  // accumulated number of steps per material
+  TH1D* histNStepsPerMat;
   // relative number of steps per volume averaged over number of events
   TH1D* histRelNStepsPerVolPerEvent;
   // number of steps made by particles of certain PDG ID averaged over number of events
@@ -129,6 +140,9 @@ class BasicMCAnalysis : public MCAnalysis
   std::unordered_map<std::string, float> pdgPresent;
   // helper to check in how many events a certain volume was traversed
   std::unordered_map<std::string, float> volPresent;
+  // helpers to count the steps and tracks of all events, used as the number of entries
+  float nStepsTotal = 0.;
+  float nTracksTotal = 0.;
 
   ClassDefNV(MCAnalysis, 1);
 };
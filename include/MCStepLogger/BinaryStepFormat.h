@@ -0,0 +1,173 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+
+/* Compact binary format for the MCStepLogger output as an alternative to the TTree
+ *
+ * The file starts with a header (magic + version + flags) followed by one chunk per event.
+ * Each chunk carries its payload size so that a reader can index all events without decoding them.
+ * The names of all volumes known from the geometry are written once in a lookups chunk before the events.
+ * Within an event chunk
+ * -> the event header identifies the event, the worker thread which transported it and the
+ *    chunk in case the event was flushed in several parts, and how its steps were sampled
+ * -> ids are written as (zigzag) varints, step and track ids delta-coded w.r.t. the previous record
+ * -> positions and energies are delta-coded per track on their bit patterns (lossless), the
+ *    steps of tracks with ids beyond MAXTRACKSTATE are delta-coded w.r.t. each other
+ * -> energies can optionally be stored as float16 (lossy)
+ * -> volume, module, medium and material names are only written the first time they appear
+ * -> the tracks finished in the chunk follow the steps and magnetic field calls
+ * The payloads of the chunks can be compressed with the algorithms of ROOT (flag FLAGCOMPRESSED). A compressed
+ * payload starts with the size of the uncompressed payload followed by ROOT compression blocks, or by the
+ * uncompressed payload if compressing it did not make it smaller.
+ *
+ * The reader maps the file into memory and decodes events into the same std::vector<StepInfo>,
+ * std::vector<MagCallInfo> and StepLookups as obtained from the TTree.
+ */
+
+#ifndef BINARY_STEP_FORMAT_H_
+#define BINARY_STEP_FORMAT_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "MCStepLogger/StepInfo.h"
+
+namespace o2
+{
+namespace binaryformat
+{
+/// identifies a binary step logger file
+constexpr char MAGIC[8] = { 'M', 'C', 'S', 'T', 'E', 'P', 'L', 'G' };
+constexpr uint32_t VERSION = 1;
+/// file flags
+constexpr uint32_t FLAGFLOAT16ENERGY = 1;
+constexpr uint32_t FLAGCOMPRESSED = 2;
+/// ROOT compression setting used if none is given (zstd, level 5)
+constexpr int DEFAULTCOMPRESSION = 505;
+/// chunk types
+constexpr uint32_t CHUNKEVENT = 1;
+constexpr uint32_t CHUNKLOOKUPS = 2;
+/// per-track delta state is only kept for track ids below this, the steps of other tracks share one state
+constexpr int MAXTRACKSTATE = 1 << 22;
+/// largest volume id a name may be stored for, anything above is taken as a corrupted file
+constexpr uint64_t MAXLOOKUPINDEX = 1 << 22;
+} // namespace binaryformat
+
+/// encodes events, keeping the state needed for incremental lookups
+class BinaryStepEncoder
+{
+ public:
+  BinaryStepEncoder(bool float16Energy = false) : mFloat16Energy(float16Energy) {}
+  /// encode one event into a complete chunk (header + payload) appended to buffer
+  void encodeEvent(const EventHeader& header, const std::vector<StepInfo>& steps, const std::vector<MagCallInfo>& calls,
+                   const StepLookups& lookups, std::vector<char>& buffer, const std::vector<TrackInfo>* tracks = nullptr);
+  /// encode the names of lookups not yet written into a lookups chunk appended to buffer
+  void encodeLookups(const StepLookups& lookups, std::vector<char>& buffer);
+  /// file header (magic, version, flags)
+  void encodeFileHeader(std::vector<char>& buffer, bool compressed = false) const;
+
+ private:
+  bool mFloat16Energy = false;
+  void putLookupNames(const StepLookups& lookups);
+
+  /// names of the lookup tables already written to previous chunks
+  std::vector<const std::string*> mVolNameWritten;
+  std::vector<const std::string*> mModuleWritten;
+  std::vector<const std::string*> mMediumWritten;
+  std::vector<const std::string*> mMaterialWritten;
+  /// last x, y, z and E bit patterns per track, reset for each event
+  std::vector<uint32_t> mTrackState;
+  std::vector<char> mPayload;
+};
+
+/// decodes chunks, keeping the state needed for incremental lookups
+class BinaryStepDecoder
+{
+ public:
+  BinaryStepDecoder(uint32_t flags = 0) : mFlags(flags) {}
+  /// decode the payload of an event chunk; secondary processes are stored in the decoder
+  /// and stay valid until the next event is decoded, tracks are skipped if not requested
+  bool decodeEvent(const char* payload, std::size_t size, EventHeader& header, std::vector<StepInfo>& steps,
+                   std::vector<MagCallInfo>& calls, StepLookups& lookups, std::vector<TrackInfo>* tracks = nullptr);
+  /// decode the payload of a lookups chunk
+  bool decodeLookups(const char* payload, std::size_t size, StepLookups& lookups);
+
+ private:
+  uint32_t mFlags = 0;
+  std::vector<int> mSecondaryProcesses;
+  std::vector<int> mSecondaryOffsets;
+  std::vector<uint32_t> mTrackState;
+  std::vector<TrackInfo> mTracks;
+};
+
+/// writes a binary step logger file
+class BinaryStepWriter
+{
+ public:
+  BinaryStepWriter() = default;
+  ~BinaryStepWriter();
+  /// compression is a ROOT compression setting (100 * algorithm + level, see TreeWriteSettings),
+  /// 0 for none and -1 for DEFAULTCOMPRESSION
+  bool open(const std::string& path, bool float16Energy = false, int compression = -1);
+  void writeEvent(const EventHeader& header, const std::vector<StepInfo>& steps, const std::vector<MagCallInfo>& calls,
+                  const StepLookups& lookups, const std::vector<TrackInfo>* tracks = nullptr);
+  /// write the names of lookups once, events then only carry names unknown to them
+  void writeLookups(const StepLookups& lookups);
+  void close();
+
+ private:
+  void write();
+
+  std::FILE* mFile = nullptr;
+  BinaryStepEncoder mEncoder;
+  int mCompression = 0;
+  std::vector<char> mBuffer;
+  std::vector<char> mCompressed;
+};
+
+/// reads a binary step logger file through a memory mapping
+class BinaryStepReader
+{
+ public:
+  BinaryStepReader() = default;
+  ~BinaryStepReader();
+  /// check for the magic number at the beginning of a file
+  static bool isBinaryFile(const std::string& path);
+  /// map the file and index all event chunks
+  bool open(const std::string& path);
+  void close();
+  /// number of events found
+  int nEvents() const { return mNEvents; }
+  /// decode events in order, lookups are accumulated over the events and lookups chunks
+  bool readNextEvent(std::vector<StepInfo>& steps, std::vector<MagCallInfo>& calls, StepLookups& lookups,
+                     EventHeader* header = nullptr, std::vector<TrackInfo>* tracks = nullptr);
+
+ private:
+  struct Chunk {
+    uint32_t type;
+    const char* payload;
+    std::size_t size;
+  };
+  /// uncompressed payload of a chunk, pointing into the mapping if the file is not compressed
+  bool payload(const Chunk& chunk, const char*& payload, std::size_t& size);
+
+  const char* mData = nullptr;
+  std::size_t mSize = 0;
+  std::vector<Chunk> mChunks;
+  int mNEvents = 0;
+  std::size_t mNextChunk = 0;
+  uint32_t mFlags = 0;
+  std::vector<char> mUncompressed;
+  BinaryStepDecoder mDecoder;
+};
+
+} // end namespace o2
+#endif /* BINARY_STEP_FORMAT_H_ */
@@ -0,0 +1,52 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+
+// low overhead time stamps used to measure the logger itself, cheap enough to be taken
+// around every single step; the time stamp counter is used on x86, a steady clock elsewhere
+
+#ifndef O2_CYCLECLOCK
+#define O2_CYCLECLOCK
+
+#include <chrono>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace o2
+{
+inline unsigned long long readCycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// frequency of readCycles, calibrated once against the steady clock
+inline double cyclesPerSecond()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  static const double frequency = [] {
+    auto start = std::chrono::steady_clock::now();
+    auto startCycles = readCycles();
+    std::chrono::duration<double> elapsed{ 0. };
+    do {
+      elapsed = std::chrono::steady_clock::now() - start;
+    } while (elapsed.count() < 0.02);
+    return (readCycles() - startCycles) / elapsed.count();
+  }();
+  return frequency;
+#else
+  return 1e9;
+#endif
+}
+} // namespace o2
+#endif
@@ -56,6 +56,16 @@ class MCAnalysis
                        const std::vector<MagCallInfo>* const magCalls) = 0;
   /// this can be overwridden
   virtual void finalize() { ; }
+  /// overwrite to return true in order to get the single chunks of events the MCStepLogger flushed in
+  /// several parts instead of the stitched event (see MCAnalysisManager::getEventHeader); step ids still count
+  /// from the beginning of the event (see MCAnalysisManager::getChunkStepOffset)
+  virtual bool isChunkAware() const { return false; }
+  /// new instance of the same analysis for a parallel worker (see MCAnalysisManager::setNWorkers), by default
+  /// created through the dictionary; overwrite if the analysis has none or cannot be default constructed
+  virtual MCAnalysis* clone() const;
+  /// overwrite to add the state of a clone which is not kept in histograms, e.g. counters used in finalize;
+  /// the histograms themselves are merged by the MCAnalysisManager
+  virtual void merge(const MCAnalysis& other) { ; }
   //
   // internal histogram managing
   //
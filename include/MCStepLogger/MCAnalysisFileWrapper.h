@@ -52,6 +52,8 @@ class MCAnalysisFileWrapper
   //
   // retrieve and modify histogram content
   //
+  /// add the histograms of another wrapper of the same analysis, matched by name
+  void merge(const MCAnalysisFileWrapper& other);
   /// check if some histogram is present in general
   bool hasHistogram(const std::string& name);
   /// get one histogram by name, exit if not present
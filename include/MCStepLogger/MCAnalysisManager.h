@@ -21,15 +21,28 @@
  *    -> forwarding the steps and magnetic field calls per event to registered analyses
  * 5. finalize
  *    -> steering all analyses to finalize its objects
+ *
+ * Instead of reading the events from a file, they can be passed in one by one from inside the
+ * simulation (online mode, see startOnline).
+ *
+ * Events which the MCStepLogger flushed in several chunks are stitched together before they are
+ * forwarded, only analyses declaring themselves chunk-aware get the single chunks. Chunks of events
+ * transported by different workers may interleave, hence the events are told apart by worker and event id.
+ *
+ * The events of a ROOT file can be distributed over several threads (see setNWorkers). Each of them
+ * gets its own clones of the analyses and their histograms which are merged before finalize.
  */
 #ifndef MCANALYSIS_MANAGER_H_
 #define MCANALYSIS_MANAGER_H_
 
+#include <map>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "MCStepLogger/StepInfo.h"
 #include "MCStepLogger/MetaInfo.h"
+#include "MCStepLogger/StepLoggerIndex.h"
 
 namespace o2
 {
@@ -59,6 +72,13 @@ class MCAnalysisManager
   bool dryrun();
   /// write produced analysis data to disk
   void write(const std::string& directory) const;
+  /// online mode: initialize to analyse events passed in by analyzeOnline
+  bool startOnline();
+  /// online mode: forward the containers of one event to the analyses
+  void analyzeOnline(std::vector<o2::StepInfo>* steps, std::vector<o2::MagCallInfo>* calls, o2::StepLookups* lookups,
+                     o2::EventHeader* header = nullptr, std::vector<o2::TrackInfo>* tracks = nullptr);
+  /// online mode: finalize and write the analyses
+  void finishOnline(const std::string& directory);
   /// terminate, reset everything
   void terminate();
   //
@@ -68,8 +88,16 @@ class MCAnalysisManager
   //void setHistogramPropertiesFile(const std:;string& filepath);
   /// set the path to the MCStepLogger input file path
   void setInputFilepath(const std::string& filepath);
+  /// analyse events streamed live by the MCStepLogger through the shared memory of that name instead of a file
+  void setInputStream(const std::string& name);
+  /// only analyse the events selected from the index of a tree output
+  void setEventSelection(const o2::EventSelection& selection);
+  /// analyse the events of a ROOT file in n threads, each with its own clones of the analyses
+  void setNWorkers(int n);
   // register analysis to manager, done implicitly in the base Analysis class during construction
   void registerAnalysis(MCAnalysis* analysis);
+  /// lookups valid for all events, used for volumes missing in the lookups of an event
+  void setRunLookups(const o2::StepLookups& lookups);
   /// label for an analysis run (e.g. 'GEANT4_allModules')
   void setLabel(const std::string& label);
   /// name of the TTree of the MCStepLogger output
@@ -85,10 +113,22 @@ class MCAnalysisManager
   void getLookupModName(int volId, std::string& name) const;
   /// medium name by volume ID
   void getLookupMedName(int volId, std::string& name) const;
+  /// material name by volume ID
+  void getLookupMatName(int volId, std::string& name) const;
   /// PDG ID by track ID
   void getLookupPDG(int trackId, int& id) const;
   /// parent track ID by track ID
   void getLookupParent(int trackId, int& parentId) const;
+  /// magnetic field calls of the current event aggregated per step, derived from the single calls
+  /// if only those were logged; the single calls are empty if only the aggregates were logged
+  const std::vector<o2::MagCallSummary>* getCallSummaries() const;
+  /// header of the current event or chunk, nullptr if the input has none
+  const o2::EventHeader* getEventHeader() const;
+  /// number of steps of the event in the chunks before the current one, 0 for complete events; step ids and the
+  /// step ids of field calls count from the beginning of the event, hence steps[call.stepid - offset] within a chunk
+  long getChunkStepOffset() const;
+  /// tracks of the current event, empty if the MCStepLogger did not record them
+  const std::vector<o2::TrackInfo>* getTracks() const;
   //
   // verbosity
   //
@@ -107,6 +147,26 @@ class MCAnalysisManager
   void initialize();
   /// analyse events and forward vectors of step and magnetic field info to single analyses
   bool analyze(int nEvents = -1, bool isDryrun = false);
+  /// loop over events of a MCStepLogger ROOT file
+  bool analyzeTTree(int nEvents, bool isDryrun);
+  /// distribute the events of a MCStepLogger ROOT file over worker threads and merge their results
+  bool analyzeParallel(int nEvents);
+  /// index of the input file, false if there is none; if requested, built from the event headers instead
+  bool readIndex(o2::StepLoggerIndex& index, bool fromHeaders) const;
+  /// loop over events of a MCStepLogger binary file
+  bool analyzeBinary(int nEvents, bool isDryrun);
+  /// loop over events streamed live by the MCStepLogger through shared memory
+  bool analyzeStream(int nEvents, bool isDryrun);
+  /// forward the current event to the analyses
+  void analyzeEvent(bool isDryrun);
+  /// append the current chunk to the event it belongs to
+  void stitchChunk();
+  /// PDG and parent lookups of the current event from its track records
+  void lookupsFromTracks();
+  /// forget the current event when the input ends
+  void resetCurrentEvent();
+  /// name of a volume from the lookups of the event or of the run, nullptr if unknown
+  const std::string* getLookupName(std::vector<std::string*> o2::StepLookups::*names, int volId) const;
   /// finalize all analyses
   void finalize();
 
@@ -118,8 +178,19 @@ class MCAnalysisManager
   /// keep track of status of MCAnalysisManager
   bool mIsInitialized = false;
   bool mIsAnalyzed = false;
+  /// events are passed in from inside the simulation
+  bool mIsOnline = false;
+  /// number of threads analysing a ROOT file
+  int mNWorkers = 1;
+  /// run by another manager on the tree entries assigned to it
+  bool mIsWorker = false;
+  std::vector<long> mEntries; //!
   /// the input file the analysis is conducted on
   std::string mInputFilepath = "";
+  /// events to be analysed, all if empty
+  o2::EventSelection mEventSelection; //!
+  /// or the name of the shared memory stream
+  std::string mInputStream = "";
   /// treename of step log data
   std::string mAnalysisTreename = defaults::defaultStepLoggerTTreeName;
   /// label for analyses, this is the same for all analyses since it depends on the simulation run and not on a specific analysis
@@ -133,8 +204,39 @@ class MCAnalysisManager
   std::vector<o2::StepInfo>* mCurrentStepInfo = nullptr;
   /// information of magnetic field calls
   std::vector<o2::MagCallInfo>* mCurrentMagCallInfo = nullptr;
+  /// magnetic field calls aggregated per step, either read or derived from the single calls
+  std::vector<o2::MagCallSummary>* mCurrentCallSummaries = nullptr;
+  bool mHasStoredCallSummaries = false;
+  std::vector<o2::MagCallSummary> mDerivedCallSummaries;
+  /// stands in for the single calls if only the aggregates were logged
+  std::vector<o2::MagCallInfo> mNoMagCalls;
   /// some lookups to map IDs to names
   o2::StepLookups* mCurrentLookups = nullptr;
+  /// lookups of all volumes written once per file, complemented by the names written with the events
+  o2::StepLookups mRunLookups;
+  /// event and chunk ids
+  o2::EventHeader* mCurrentEventHeader = nullptr;
+  /// one record per track, only present if the track boundaries were intercepted
+  std::vector<o2::TrackInfo>* mCurrentTracks = nullptr;
+  std::vector<o2::TrackInfo> mNoTracks;
+  /// what the analyses get, either the current containers or the stitched event
+  std::vector<o2::StepInfo>* mEventSteps = nullptr;
+  std::vector<o2::MagCallInfo>* mEventMagCalls = nullptr;
+  std::vector<o2::MagCallSummary>* mEventCallSummaries = nullptr;
+  o2::StepLookups* mEventLookups = nullptr;
+  std::vector<o2::TrackInfo>* mEventTracks = nullptr;
+  /// an event stitched together from its chunks
+  struct StitchedEvent {
+    std::vector<o2::StepInfo> steps;
+    std::vector<o2::MagCallInfo> magCalls;
+    std::vector<o2::MagCallSummary> callSummaries;
+    o2::StepLookups lookups;
+    std::vector<o2::TrackInfo> tracks;
+    o2::SecondaryProcessArena arena;
+  };
+  /// events not yet complete by worker and event id
+  std::map<std::pair<int, int>, StitchedEvent> mStitchedEvents; //!
+  long mChunkStepOffset = 0;
   /// analysis files histograms are written to
   std::vector<MCAnalysisFileWrapper> mAnalysisFiles;
   /// A JSON file to overwrite histogram properties used in MCAnalysis objects
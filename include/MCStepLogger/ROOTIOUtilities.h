@@ -144,6 +144,11 @@ class ROOTIOUtilities
     }
     return false;
   }
+  /// check whether a branch is present in the current TTree
+  bool hasBranch(const std::string& branchname) const
+  {
+    return mTTreeOpened && mTTree->GetBranch(branchname.c_str()) != nullptr;
+  }
   /// reset internal counters
   void resetTTreeCounter();
   /// reset branch addresses
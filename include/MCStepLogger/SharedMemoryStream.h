@@ -0,0 +1,102 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+
+/* Live stream of the MCStepLogger output through POSIX shared memory
+ *
+ * The logger (single producer) publishes events into a ring buffer in a shared memory segment
+ * which one consumer process at a time can attach to. Events are encoded as chunks of the
+ * binary format (see BinaryStepFormat.h), hence nothing touches the disk.
+ * -> events are only published while a consumer is attached, all others are counted as dropped
+ * -> if the ring is full, the producer waits for the consumer (backpressure) or drops the event
+ * -> when a consumer attaches or an event was dropped, the next event carries all lookup names again,
+ *    preceded by the names known for the whole run (see setLookups)
+ */
+
+#ifndef SHARED_MEMORY_STREAM_H_
+#define SHARED_MEMORY_STREAM_H_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "MCStepLogger/BinaryStepFormat.h"
+
+namespace o2
+{
+namespace shmstream
+{
+/// identifies a step logger stream
+constexpr char MAGIC[8] = { 'M', 'C', 'S', 'T', 'E', 'P', 'S', 'H' };
+constexpr uint32_t VERSION = 1;
+} // namespace shmstream
+
+/// layout of the beginning of the shared memory segment, defined in the implementation
+struct SharedMemoryRingHeader;
+
+/// publishes events to a shared memory ring buffer
+class SharedMemoryStreamWriter
+{
+ public:
+  SharedMemoryStreamWriter() = default;
+  ~SharedMemoryStreamWriter();
+  /// create the segment, an old segment of the same name is replaced
+  bool create(const std::string& name, std::size_t capacity, bool dropWhenFull = false, bool float16Energy = false);
+  void writeEvent(const EventHeader& header, const std::vector<StepInfo>& steps, const std::vector<MagCallInfo>& calls,
+                  const StepLookups& lookups, const std::vector<TrackInfo>* tracks = nullptr);
+  /// names known for the whole run, sent once to each consumer before its first event
+  void setLookups(const StepLookups* lookups) { mLookups = lookups; }
+  /// tell the consumer that no more events follow and remove the segment
+  void close();
+  /// number of events which were not published
+  unsigned long nDropped() const;
+
+ private:
+  void drop();
+  void resetEncoder();
+
+  SharedMemoryRingHeader* mHeader = nullptr;
+  char* mRing = nullptr;
+  std::size_t mMappedSize = 0;
+  std::string mName;
+  bool mDropWhenFull = false;
+  bool mFloat16Energy = false;
+  BinaryStepEncoder mEncoder;
+  std::vector<char> mBuffer;
+  const StepLookups* mLookups = nullptr;
+  bool mLookupsPending = false;
+};
+
+/// reads events from a shared memory ring buffer
+class SharedMemoryStreamReader
+{
+ public:
+  SharedMemoryStreamReader() = default;
+  ~SharedMemoryStreamReader();
+  /// attach to the stream, waiting at most timeout seconds for the producer to appear
+  bool attach(const std::string& name, int timeout = 60);
+  void detach();
+  /// wait for the next event, false once the producer closed the stream and all events were read
+  bool readNextEvent(std::vector<StepInfo>& steps, std::vector<MagCallInfo>& calls, StepLookups& lookups,
+                     EventHeader* header = nullptr, std::vector<TrackInfo>* tracks = nullptr);
+  /// number of events the producer did not publish
+  unsigned long nDropped() const;
+
+ private:
+  void copyFromRing(uint64_t position, char* destination, std::size_t size) const;
+
+  SharedMemoryRingHeader* mHeader = nullptr;
+  const char* mRing = nullptr;
+  std::size_t mMappedSize = 0;
+  std::vector<char> mPayload;
+  BinaryStepDecoder mDecoder;
+};
+
+} // end namespace o2
+#endif /* SHARED_MEMORY_STREAM_H_ */
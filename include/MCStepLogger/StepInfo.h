@@ -12,9 +12,12 @@
 #define O2_STEPINFO
 
 #include <Rtypes.h>
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <vector>
 
 class TVirtualMC;
@@ -57,11 +60,16 @@ struct StepLookups {
   std::vector<std::string*> volidtovolname;
   std::vector<std::string*> volidtomodule;
   std::vector<std::string*> volidtomedium;
+  std::vector<std::string*> volidtomaterial;
   std::vector<int> tracktopdg;
   std::vector<int> tracktoparent; // when parent is -1 we mean primary
 
   void insertVolName(int index, std::string const& s) { insertValueAt(index, s, volidtovolname); }
+  // true if the name of a volume was already inserted
+  bool hasVolName(int index) const { return index >= 0 && index < volidtovolname.size() && volidtovolname[index] != nullptr; }
   void insertModuleName(int index, std::string const& s) { insertValueAt(index, s, volidtomodule); }
+  void insertMediumName(int index, std::string const& s) { insertValueAt(index, s, volidtomedium); }
+  void insertMaterialName(int index, std::string const& s) { insertValueAt(index, s, volidtomaterial); }
   std::string* getModuleAt(int index) const
   {
     if (index >= volidtomodule.size())
@@ -95,26 +103,109 @@ struct StepLookups {
     tracktoparent[trackindex] = parent;
   }
 
+  // add names known to other, e.g. written with a previous event, names of other take precedence
+  void mergeNames(StepLookups const& other)
+  {
+    auto mergeContainer = [](std::vector<std::string*> const& from, std::vector<std::string*>& to) {
+      if (from.size() > to.size()) {
+        to.resize(from.size(), nullptr);
+      }
+      for (int i = 0; i < from.size(); ++i) {
+        if (from[i] && (!to[i] || to[i]->compare(*from[i]) != 0)) {
+          to[i] = intern(*from[i]);
+        }
+      }
+    };
+    mergeContainer(other.volidtovolname, volidtovolname);
+    mergeContainer(other.volidtomodule, volidtomodule);
+    mergeContainer(other.volidtomedium, volidtomedium);
+    mergeContainer(other.volidtomaterial, volidtomaterial);
+  }
+
+  // add names and tracks known to other, e.g. from another chunk of the same event
+  void merge(StepLookups const& other)
+  {
+    mergeNames(other);
+    for (int i = 0; i < other.tracktopdg.size(); ++i) {
+      if (other.tracktopdg[i] != 0) {
+        insertPDG(i, other.tracktopdg[i]);
+      }
+    }
+    for (int i = 0; i < other.tracktoparent.size(); ++i) {
+      if (other.tracktoparent[i] != -1) {
+        insertParent(i, other.tracktoparent[i]);
+      }
+    }
+  }
+
  private:
   void insertValueAt(int index, std::string const& s, std::vector<std::string*>& container)
   {
     if (index >= container.size()) {
       container.resize(index + 1, nullptr);
     }
-    //#ifdef CHECKMODE
     // check that if a value exists at some index it is the same that we want to write
-    if (container[index] != nullptr) {
-      auto previous = *(container[index]);
-      if (s.compare(previous) != 0) {
-        std::cerr << "trying to override " << previous << " with " << s << "\n";
+    auto previous = container[index];
+    if (previous != nullptr) {
+      if (s.compare(*previous) == 0) {
+        return;
       }
+      std::cerr << "trying to override " << *previous << " with " << s << "\n";
     }
-    //#endif
-    // can we use unique pointers??
-    container[index] = new std::string(s);
+    container[index] = intern(s);
   }
 
-  ClassDefNV(StepLookups, 1);
+  // pointer to a unique copy of a string which lives until the end of the process,
+  // hence lookups can be copied and the same names (e.g. modules) are only stored once
+  static std::string* intern(std::string const& s);
+
+  ClassDefNV(StepLookups, 2);
+};
+
+// arena holding the secondary process ids of all steps of one event
+// memory blocks are kept when the arena is reset so that no heap allocations
+// are needed once the arena has grown to the size of a typical event
+class SecondaryProcessArena
+{
+ public:
+  // get space for n integers
+  int* allocate(int n);
+  // O(1), memory is kept for the next event
+  void reset()
+  {
+    mCurrentBlock = 0;
+    mOffset = 0;
+  }
+  // exchange content with another arena
+  void swap(SecondaryProcessArena& other)
+  {
+    mBlocks.swap(other.mBlocks);
+    std::swap(mCurrentBlock, other.mCurrentBlock);
+    std::swap(mOffset, other.mOffset);
+  }
+  // number of memory blocks allocated through this arena so far
+  long heapAllocations() const { return mHeapAllocations; }
+  // bytes handed out since the last reset (apart from what was skipped at the end of blocks)
+  std::size_t used() const
+  {
+    std::size_t n = mOffset;
+    for (std::size_t i = 0; i < mCurrentBlock && i < mBlocks.size(); ++i) {
+      n += mBlocks[i].size;
+    }
+    return n * sizeof(int);
+  }
+
+ private:
+  struct Block {
+    Block(int s) : data(new int[s]), size(s) {}
+    std::unique_ptr<int[]> data;
+    int size;
+  };
+  static constexpr int BLOCKSIZE = 1 << 16;
+  std::vector<Block> mBlocks;
+  std::size_t mCurrentBlock = 0;
+  int mOffset = 0;
+  long mHeapAllocations = 0;
 };
 
 struct StepInfo {
@@ -122,7 +213,6 @@ struct StepInfo {
   // construct directly using virtual mc
   StepInfo(TVirtualMC* mc);
 
-  // long cputimestamp;
   int stepid = -1; // serves as primary key
   int volId = -1;  // keep another branch somewhere mapping this to name, medium, etc.
   int copyNo = -1;
@@ -137,16 +227,51 @@ struct StepInfo {
   int* secondaryprocesses = nullptr; //[nsecondaries]
   int nprocessesactive = 0;          // number of active processes
   bool stopped = false;              //
+  float weight = 1.;                 // statistical weight in case only a fraction of steps is logged
+  int firstprocess = -1;             // first of the active processes, not necessarily the one limiting the step
+  float cputime = 0.;                // time in seconds spent transporting this step (only if timing is enabled)
 
-  static int stepcounter;           //!
-  static StepInfo* currentinstance; //!
-  static std::chrono::time_point<std::chrono::high_resolution_clock> starttime;
+  // counters, lookups and the arena are per thread so that each worker
+  // of a multithreaded engine logs its own events
+  static thread_local int stepcounter;           //!
+  static thread_local StepInfo* currentinstance; //!
   static void resetCounter() { stepcounter = -1; }
+  // shared by all threads, only read after initialization
   static std::map<std::string, std::string>* volnametomodulemap;
   static std::vector<std::string*> volidtomodulevector;
+  // if set, secondary processes are stored there instead of the heap
+  static thread_local SecondaryProcessArena* secondaryarena; //!
 
-  static StepLookups lookupstructures;
-  ClassDefNV(StepInfo, 2);
+  static thread_local StepLookups lookupstructures;
+  // set once the start of a track was intercepted, PDG and parent are then no longer inserted per step
+  static thread_local bool tracksrecorded; //!
+  // names, media, materials and modules of all volumes, built once from the geometry and shared by all threads,
+  // lookupstructures then only hold the names of volumes unknown to the geometry
+  static StepLookups geometrylookups;
+  // false if the volume ids of the engine turn out not to match the geometry
+  static std::atomic<bool> usegeometrylookups; //!
+  // walk gGeoManager, returns the number of volumes found
+  static int initGeometryLookups();
+  // if set, the time spent resolving lookups is accumulated in lookupcycles
+  static bool instrumented;                        //!
+  static thread_local unsigned long long lookupcycles; //!
+  ClassDefNV(StepInfo, 5);
+};
+
+// one transported track, recorded when the track is finished
+struct TrackInfo {
+  int trackID = -1;
+  int pdg = 0;
+  int parent = -1;  // -1 for primaries
+  int primary = -1; // the primary the track stems from
+  float x = 0.;     // vertex
+  float y = 0.;
+  float z = 0.;
+  float E = 0.;      // total energy at the vertex
+  int nsteps = 0;    // all steps of the track, also those which were not logged
+  float length = 0.; // track length
+
+  ClassDefNV(TrackInfo, 1);
 };
 
 struct MagCallInfo {
@@ -159,9 +284,133 @@ struct MagCallInfo {
   float y = 0.;
   float z = 0.;
   float B = 0.; // absolute value of the B field
+  float weight = 1.; // statistical weight, same as for the step the call is attributed to
+  float calltime = 0.; // time in seconds spent in the original Field() (only if field timing is enabled)
+
+  static thread_local int stepcounter;
+  ClassDefNV(MagCallInfo, 3);
+};
+
+// the magnetic field calls of one step aggregated, stored instead of the single calls in the aggregated mode
+struct MagCallSummary {
+  long stepid = -1; // the step the calls are attributed to
+  int ncalls = 0;
+  int nsmall = 0; // number of calls with B < SMALLFIELD
+  float Bmin = 0.;
+  float Bmax = 0.;
+  float Bmean = 0.;
+  float weight = 1.;   // same as for the step, applies to ncalls, nsmall and calltime alike
+  float calltime = 0.; // summed over the calls (only if field timing is enabled), not weighted
+
+  // calls below are considered useless
+  static constexpr float SMALLFIELD = 0.01;
+
+  // aggregate one more call of the same step
+  void add(MagCallInfo const& call);
+  // aggregate consecutive calls of the same step
+  static void summarize(std::vector<MagCallInfo> const& calls, std::vector<MagCallSummary>& summaries);
+
+  ClassDefNV(MagCallSummary, 1);
+};
+
+// magnetic field calls and the time spent in them aggregated during one event, calls, times and steps
+// are weighted with the weight of their step in case only a fraction of the steps was logged
+struct FieldStats {
+  std::vector<double> callspervolume; // indexed by volume id
+  std::vector<double> timepervolume;  // in seconds, indexed by volume id
+  std::vector<double> callsperbucket; // per |B| bucket, see bucket()
+  std::vector<double> timeperbucket;  // in seconds, per |B| bucket
+  std::vector<double> stepspercalls;  // number of steps with n calls, the last entry counts all steps with more calls
+  // simulated field cache (only if enabled)
+  std::vector<long> cachequeriespervolume; // indexed by volume id
+  std::vector<long> cacherepeatspervolume; // queries found in the cache, indexed by volume id
+  std::vector<long> cachehitsatdepth;      // queries found at a given LRU position, a cache with n entries hits all below n
+
+  static constexpr int NBUCKETS = 6;
+  static constexpr int MAXCALLSPERSTEP = 16;
+  // upper edge of a |B| bucket (same unit as MagCallInfo::B), the last bucket has no upper edge
+  static float bucketEdge(int bucket)
+  {
+    constexpr float edges[NBUCKETS - 1] = { 0.001, 0.01, 0.1, 1., 10. };
+    return edges[bucket];
+  }
+  static int bucket(float B)
+  {
+    int i = 0;
+    while (i < NBUCKETS - 1 && B >= bucketEdge(i)) {
+      ++i;
+    }
+    return i;
+  }
+  // keeps the volume sizes
+  void clear()
+  {
+    std::fill(callspervolume.begin(), callspervolume.end(), 0);
+    std::fill(timepervolume.begin(), timepervolume.end(), 0.);
+    std::fill(cachequeriespervolume.begin(), cachequeriespervolume.end(), 0);
+    std::fill(cacherepeatspervolume.begin(), cacherepeatspervolume.end(), 0);
+    std::fill(cachehitsatdepth.begin(), cachehitsatdepth.end(), 0);
+    callsperbucket.assign(NBUCKETS, 0);
+    timeperbucket.assign(NBUCKETS, 0.);
+    stepspercalls.assign(MAXCALLSPERSTEP + 1, 0);
+  }
+
+  ClassDefNV(FieldStats, 3);
+};
+
+// how the logged steps were chosen (MCSTEPLOG_SAMPLING)
+enum class SamplingMode : int { kNone,
+                                kUniform,
+                                kTrack,
+                                kPrimary };
+
+// identifies an event in the output, events of different workers are interleaved
+struct EventHeader {
+  int eventid = -1; // event number given by the MC engine
+  int workerid = 0; // worker thread which transported the event
+  // events exceeding the memory budget of the logger are flushed in several chunks,
+  // track lookups of a chunk only cover the tracks of its steps
+  int chunk = 0;          // index of the chunk within the event
+  bool lastchunk = true;  // the event is complete with this chunk
+  // a SamplingMode, with track and primary sampling the weights apply to whole tracks
+  int sampling = static_cast<int>(SamplingMode::kNone);
+
+  ClassDefNV(EventHeader, 3);
+};
+
+// overhead of the logger itself during one event, measured with readCycles (see CycleClock.h)
+struct LoggerStats {
+  long nsteps = 0;                       // steps seen by the logger, logged or not
+  long nfieldcalls = 0;                  // field calls seen by the logger, logged or not
+  unsigned long long capture = 0;        // performLogging apart from lookups and growth
+  unsigned long long lookups = 0;        // resolving names, PDG codes and parents of steps
+  unsigned long long growth = 0;         // growing the step container
+  unsigned long long field = 0;          // logField
+  unsigned long long flush = 0;          // writing the previous event (the current one is written together with this)
+  unsigned long long stepping = 0;       // original Stepping(), not part of the overhead
+  unsigned long long fieldoriginal = 0;  // original Field(), not part of the overhead
+  double cyclespersecond = 1.;
+
+  unsigned long long overhead() const { return capture + lookups + growth + field + flush; }
+  double seconds(unsigned long long cycles) const { return cycles / cyclespersecond; }
+  void add(LoggerStats const& other)
+  {
+    nsteps += other.nsteps;
+    nfieldcalls += other.nfieldcalls;
+    capture += other.capture;
+    lookups += other.lookups;
+    growth += other.growth;
+    field += other.field;
+    flush += other.flush;
+    stepping += other.stepping;
+    fieldoriginal += other.fieldoriginal;
+    cyclespersecond = other.cyclespersecond;
+  }
+  void reset() { *this = LoggerStats{ 0, 0, 0, 0, 0, 0, 0, 0, 0, cyclespersecond }; }
+  // print a breakdown in ms to stderr
+  void print(const char* what) const;
 
-  static int stepcounter;
-  ClassDefNV(MagCallInfo, 1);
+  ClassDefNV(LoggerStats, 1);
 };
 }
 #endif
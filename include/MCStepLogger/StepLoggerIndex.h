@@ -0,0 +1,94 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+
+/* Per-event index written next to the StepLoggerTree
+ *
+ * One small record per tree entry (event or chunk of an event) with its size in steps, field calls,
+ * tracks and bytes. Events can hence be selected without reading the big branches, e.g.
+ * -> ranges of events, counted in the order they are completed in the file
+ * -> cuts on the sizes like "nsteps>1e6"
+ */
+
+#ifndef STEP_LOGGER_INDEX_H_
+#define STEP_LOGGER_INDEX_H_
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Rtypes.h"
+
+namespace o2
+{
+struct EventIndexEntry {
+  long entry = -1;     // entry in the StepLoggerTree
+  int eventid = -1;    // as in the EventHeader
+  int workerid = 0;
+  int chunk = 0;
+  bool lastchunk = true;
+  long nsteps = 0;     // logged steps
+  long ncalls = 0;     // logged magnetic field calls
+  int ntracks = 0;
+  int nprimaries = 0;
+  long bytes = 0;      // uncompressed size of the entry
+  float walltime = 0.; // seconds since the previous entry of the same worker, 0 if unknown
+
+  // add the sizes of another chunk of the same event
+  void add(EventIndexEntry const& other);
+
+  ClassDefNV(EventIndexEntry, 1);
+};
+
+// a complete event, summed up over its chunks
+struct IndexedEvent {
+  EventIndexEntry summary;
+  std::vector<long> entries;
+};
+
+struct StepLoggerIndex {
+  std::vector<EventIndexEntry> entries;
+
+  // complete events in the order their last chunk appears in the tree
+  std::vector<IndexedEvent> events() const;
+
+  ClassDefNV(StepLoggerIndex, 1);
+};
+
+// ranges of events and cuts on their sizes, all of which have to be fulfilled
+class EventSelection
+{
+ public:
+  /// comma separated event numbers or ranges, e.g. "0-9,20,100-", events are counted from 0
+  bool addRanges(const std::string& spec);
+  /// <quantity><operator><value>, e.g. "nsteps>1e6", quantities are the ones of EventIndexEntry
+  bool addCut(const std::string& spec);
+  bool empty() const { return mRanges.empty() && mCuts.empty(); }
+  /// selected events, an empty selection keeps all
+  std::vector<IndexedEvent> select(const StepLoggerIndex& index) const;
+  /// tree entries of the selected events in increasing order
+  std::vector<long> selectEntries(const StepLoggerIndex& index) const;
+
+ private:
+  struct Cut {
+    std::string quantity;
+    std::string op;
+    double value;
+  };
+  bool accept(int number, EventIndexEntry const& event) const;
+
+  std::vector<std::pair<long, long>> mRanges;
+  std::vector<Cut> mCuts;
+};
+
+/// distribute events over n partitions with about the same number of steps each,
+/// the tree entries of each partition in increasing order
+std::vector<std::vector<long>> partitionEvents(const std::vector<IndexedEvent>& events, int n);
+} // end namespace o2
+#endif /* STEP_LOGGER_INDEX_H_ */
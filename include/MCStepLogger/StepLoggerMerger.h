@@ -0,0 +1,30 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+
+/* Merging the tree outputs of independent MCStepLogger jobs into one file
+ *
+ * -> the event branches are copied basket by basket without deserializing the steps
+ * -> the event headers are rewritten so that event ids are unique in the merged file
+ * -> the run lookups of all inputs are combined into a single RunLookups object
+ */
+
+#ifndef STEP_LOGGER_MERGER_H_
+#define STEP_LOGGER_MERGER_H_
+
+#include <string>
+#include <vector>
+
+namespace o2
+{
+/// merge the StepLoggerTrees of the input files into outputFile, inputs whose branches
+/// do not match the first one are skipped; false if nothing could be merged
+bool mergeStepLoggerFiles(const std::vector<std::string>& inputFiles, const std::string& outputFile);
+} // end namespace o2
+#endif /* STEP_LOGGER_MERGER_H_ */
@@ -0,0 +1,87 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+
+/* This class analyses where the transport time is spent. It requires the MCStepLogger
+ * to be run with MCSTEPLOG_TIMING=1 so that the time between 2 consecutive steps is
+ * attributed to each step. Derived are
+ *
+ * -> time per event
+ * -> time per volume
+ * -> time per module
+ * -> time per PDG ID
+ * -> time per first active process of the step
+ * -> mean time per step per volume
+ * -> time spent in the magnetic field per event, volume and module
+ *    (requires MCSTEPLOG_FIELDTIMING=1, calls are attributed to the volume of their step)
+ *
+ * All times are in seconds and averaged over the number of events such that the
+ * contributions of all volumes (modules, ...) add up to the time per event.
+ */
+
+#ifndef TIMING_MCANALYSIS_H_
+#define TIMING_MCANALYSIS_H_
+
+#include <unordered_map>
+
+#include "MCStepLogger/MCAnalysis.h"
+
+namespace o2
+{
+namespace mcstepanalysis
+{
+
+class TimingMCAnalysis : public MCAnalysis
+{
+ public:
+  TimingMCAnalysis();
+
+ protected:
+  /// custom initialization of histograms
+  void initialize() override;
+  /// custom event loop
+  void analyze(const std::vector<StepInfo>* const steps, const std::vector<MagCallInfo>* const magCalls) override;
+  /// custom finalizations of produced histograms
+  void finalize() override;
+  /// for parallel workers
+  MCAnalysis* clone() const override { return new TimingMCAnalysis(); }
+  /// add the helpers of a clone
+  void merge(const MCAnalysis& other) override;
+
+ private:
+  // number of events
+  TH1D* histNEvents;
+  // time per event
+  TH1D* histTimePerEvent;
+  // time per volume averaged over number of events
+  TH1D* histTimePerVolPerEvent;
+  // time per module averaged over number of events
+  TH1D* histTimePerModPerEvent;
+  // time per PDG ID averaged over number of events
+  TH1D* histTimePerPDGPerEvent;
+  // time per first active process of the step averaged over number of events
+  TH1D* histTimePerProcessPerEvent;
+  // mean time per step in a volume
+  TH1D* histMeanTimePerStepPerVol;
+  // time in field calls per event
+  TH1D* histFieldTimePerEvent;
+  // time in field calls per volume averaged over number of events
+  TH1D* histFieldTimePerVolPerEvent;
+  // time in field calls per module averaged over number of events
+  TH1D* histFieldTimePerModPerEvent;
+  // helper mapping step ids to volumes to attribute field calls
+  std::unordered_map<long, int> stepIdToVolId;
+  // helper counting the steps per volume to derive the mean time per step
+  std::unordered_map<std::string, double> nStepsPerVol;
+
+  ClassDefNV(TimingMCAnalysis, 2);
+};
+} // namespace mcstepanalysis
+} // namespace o2
+#endif /* TIMING_MCANALYSIS_H_ */
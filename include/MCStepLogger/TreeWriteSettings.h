@@ -0,0 +1,58 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+
+/* How the tree output of the MCStepLogger is written to disk
+ *
+ * -> compression given as <algorithm>[:<level>] with algorithm one of zlib, lzma, lz4, zstd or none
+ * -> basket size (bytes) and split level of the event branches
+ * The same settings are used by the logger (MCSTEPLOG_COMPRESSION, MCSTEPLOG_BASKETSIZE,
+ * MCSTEPLOG_SPLITLEVEL) and by the benchmark of mcStepAnalysis.
+ */
+
+#ifndef TREE_WRITE_SETTINGS_H_
+#define TREE_WRITE_SETTINGS_H_
+
+#include <string>
+#include <vector>
+
+#include "TFile.h"
+#include "TTree.h"
+
+namespace o2
+{
+struct TreeWriteSettings {
+  /// ROOT compression settings (100 * algorithm + level), -1 keeps the default of ROOT
+  int compression = -1;
+  /// buffer size of each basket and split level, the defaults of TTree::Branch
+  int basketsize = 32000;
+  int splitlevel = 99;
+
+  /// parse <algorithm>[:<level>] with a level from 0 (no compression) to 9, false if the algorithm is unknown or
+  /// the level is not such a number
+  bool setCompression(const std::string& spec);
+  /// human readable description, e.g. "lz4:4 basket 32000 split 99"
+  std::string describe() const;
+  /// apply the compression to a file, before any tree is created in it
+  void apply(TFile* file) const;
+  /// create a branch with the basket size and split level
+  template <typename T>
+  TBranch* branch(TTree* tree, const char* name, T** address) const
+  {
+    return tree->Branch(name, address, basketsize, splitlevel);
+  }
+};
+
+/// rewrite the events of a MCStepLogger tree with each of the settings and print the write and read
+/// throughput and the resulting file size, optionally also for the binary format with each compression;
+/// false if the input cannot be read
+bool benchmarkTreeWriting(const std::string& inputFile, const std::vector<TreeWriteSettings>& settings,
+                          const std::string& outputDir, int nEvents = -1, bool withBinary = false);
+} // end namespace o2
+#endif /* TREE_WRITE_SETTINGS_H_ */
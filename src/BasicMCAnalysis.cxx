@@ -45,6 +45,10 @@ void BasicMCAnalysis::initialize()
   histRelNStepsPerVolPerEvent = getHistogram<TH1D>("relNStepsPerVolPerEvent", 1, 0., 1.);
   // number of steps done per module (unormalized)
   histNStepsPerMod = getHistogram<TH1D>("nStepPerMod", 1, 0., 1.);
+  // number of steps done per medium (unormalized)
+  histNStepsPerMed = getHistogram<TH1D>("nStepPerMed", 1, 0., 1.);
+  // number of steps done per material (unormalized)
+  histNStepsPerMat = getHistogram<TH1D>("nStepPerMat", 1, 0., 1.);
   // number of steps made by particles of certain PDG ID averaged over number of events
   histNStepsPerPDGPerEvent = getHistogram<TH1D>("nStepsPerPDGPerEvent", 1, 0., 1.);
   // relative number of steps made by particles of certain PDG ID averaged over number of events
@@ -83,6 +87,9 @@ void BasicMCAnalysis::initialize()
   volPresent.clear();
   // helper to check in how many events a certain volume was traversed
   pdgPresent.clear();
+  // helpers to count the steps and tracks of all events
+  nStepsTotal = 0.;
+  nTracksTotal = 0.;
 }
 
 void BasicMCAnalysis::analyze(const std::vector<StepInfo>* const steps, const std::vector<MagCallInfo>* const magCalls)
@@ -93,22 +100,28 @@ void BasicMCAnalysis::analyze(const std::vector<StepInfo>* const steps, const st
   std::string volName = "";
   // to store the module name
   std::string modName = "";
+  std::string medName = "";
+  std::string matName = "";
 
-  // loop over magnetic field calls
-  for (const auto& call : *magCalls) {
-    if (call.stepid < 0) {
+  // loop over magnetic field calls aggregated per step, available whether single calls were logged or not
+  for (const auto& summary : *mAnalysisManager->getCallSummaries()) {
+    if (summary.stepid < 0) {
       continue;
     }
-    auto step = steps->operator[](call.stepid);
+    auto& step = steps->operator[](summary.stepid);
     mAnalysisManager->getLookupVolName(step.volId, volName);
-    if (call.B < 0.01) {
-      histSmallMagFieldCallsPerVolPerEvent->Fill(volName.c_str(), 1.);
-    }
-    histMagFieldCallsPerVolPerEvent->Fill(volName.c_str(), 1.);
+    histSmallMagFieldCallsPerVolPerEvent->Fill(volName.c_str(), summary.nsmall * summary.weight);
+    histMagFieldCallsPerVolPerEvent->Fill(volName.c_str(), summary.ncalls * summary.weight);
   }
 
-  // total number of steps in this event
-  int nSteps = 0;
+  // total number of steps in this event, all counts are weighted in case steps were sampled
+  float nSteps = 0.;
+  // number of different tracks, only weighted if whole tracks were sampled; with uniform sampling
+  // a track is counted once if any of its steps was logged, hence a lower bound
+  float nTracks = 0.;
+  auto header = mAnalysisManager->getEventHeader();
+  const bool isTrackSampled = header && (header->sampling == static_cast<int>(SamplingMode::kTrack) ||
+                                         header->sampling == static_cast<int>(SamplingMode::kPrimary));
   // to store particle ID
   int pdgId = 0;
   // get the mean step size per event
@@ -118,12 +131,12 @@ void BasicMCAnalysis::analyze(const std::vector<StepInfo>* const steps, const st
   // step sizes per volume id in one event
   std::vector<float> stepSizesPerVol;
   // number of steps per volume ID in this event
-  std::vector<int> nStepsPerVol;
+  std::vector<float> nStepsPerVol;
   // steps sizes per PDG ID in one event, use a map here since PDG IDs can be large (~10^10)
   // don't attempt to handle such a vector
   std::unordered_map<int, float> stepSizesPerPDGMap;
   // number of steps per PDG ID in this event
-  std::unordered_map<int, int> nStepsPerPDGMap;
+  std::unordered_map<int, float> nStepsPerPDGMap;
 
   // loop over all steps in an event
   for (const auto& step : *steps) {
@@ -131,19 +144,29 @@ void BasicMCAnalysis::analyze(const std::vector<StepInfo>* const steps, const st
     mAnalysisManager->getLookupPDG(step.trackID, pdgId);
     mAnalysisManager->getLookupVolName(step.volId, volName);
     mAnalysisManager->getLookupModName(step.volId, modName);
+    mAnalysisManager->getLookupMedName(step.volId, medName);
+    mAnalysisManager->getLookupMatName(step.volId, matName);
+
+    // weight of this step, 1 unless only a fraction of steps was logged
+    const float weight = step.weight;
 
     // first increment the total number of steps over all events
-    nSteps++;
+    nSteps += weight;
 
     // record number of steps per module
-    histNStepsPerMod->Fill(modName.c_str(), 1.);
+    histNStepsPerMod->Fill(modName.c_str(), weight);
+    // and per medium and material, known if the lookups were built from the geometry
+    histNStepsPerMed->Fill(medName.c_str(), weight);
+    histNStepsPerMat->Fill(matName.c_str(), weight);
 
     // avoid double counting of tracks in an event, so check if track ID is already registered
     if (std::find(tracks.begin(), tracks.end(), step.trackID) == tracks.end() && step.trackID > -1) {
       // if not, there is a new track
       tracks.push_back(step.trackID);
+      const float trackWeight = isTrackSampled ? weight : 1.;
+      nTracks += trackWeight;
       // increment track per PDG ID and treat PDGs as alphanumeric labels, so we can easily deflate later
-      histNTracksPerPDGPerEvent->Fill(std::to_string(pdgId).c_str(), 1.);
+      histNTracksPerPDGPerEvent->Fill(std::to_string(pdgId).c_str(), trackWeight);
     }
     // summarize all volume Ids over all events to see, how many volumes were traversed in total
     if (std::find(volIds.begin(), volIds.end(), step.volId) == volIds.end() && step.volId > -1) {
@@ -151,11 +174,11 @@ void BasicMCAnalysis::analyze(const std::vector<StepInfo>* const steps, const st
     }
 
     // get the spatial coordinates of this step
-    histStepsXPerEvent->Fill(step.x);
-    histStepsYPerEvent->Fill(step.y);
-    histStepsZPerEvent->Fill(step.z);
-    histRZ->Fill(step.z, std::sqrt(step.x * step.x + step.y * step.y));
-    histStepsEnergyPerEvent->Fill(step.E);
+    histStepsXPerEvent->Fill(step.x, weight);
+    histStepsYPerEvent->Fill(step.y, weight);
+    histStepsZPerEvent->Fill(step.z, weight);
+    histRZ->Fill(step.z, std::sqrt(step.x * step.x + step.y * step.y), weight);
+    histStepsEnergyPerEvent->Fill(step.E, weight);
     // extract the step length
     float stepLength = 0.;
     // be save and check whether there are e.g. NaNs (happened!)
@@ -163,43 +186,41 @@ void BasicMCAnalysis::analyze(const std::vector<StepInfo>* const steps, const st
       stepLength = step.step;
     }
     // summarise all steps sizes
-    histStepSizesPerEvent->Fill(stepLength);
+    histStepSizesPerEvent->Fill(stepLength, weight);
     // summarise steps sizes per volume in this event
     if (stepSizesPerVol.size() <= step.volId) {
       stepSizesPerVol.resize(step.volId + 1, 0.);
       nStepsPerVol.resize(step.volId + 1, 0);
     }
-    stepSizesPerVol[step.volId] += stepLength;
-    nStepsPerVol[step.volId]++;
+    stepSizesPerVol[step.volId] += weight * stepLength;
+    nStepsPerVol[step.volId] += weight;
     // summarise step sizes per PDG ID in this event
     if (stepSizesPerPDGMap.find(pdgId) == stepSizesPerPDGMap.end()) {
-      stepSizesPerPDGMap[pdgId] = stepLength;
-      nStepsPerPDGMap[pdgId] = 1;
+      stepSizesPerPDGMap[pdgId] = weight * stepLength;
+      nStepsPerPDGMap[pdgId] = weight;
     } else {
-      stepSizesPerPDGMap[pdgId] += stepLength;
-      nStepsPerPDGMap[pdgId]++;
+      stepSizesPerPDGMap[pdgId] += weight * stepLength;
+      nStepsPerPDGMap[pdgId] += weight;
     }
 
     // secondaries
-    histNSecondariesPerEvent->Fill(0.5, step.nsecondaries);
-    histNSecondariesPerVolPerEvent->Fill(volName.c_str(), step.nsecondaries);
+    histNSecondariesPerEvent->Fill(0.5, weight * step.nsecondaries);
+    histNSecondariesPerVolPerEvent->Fill(volName.c_str(), weight * step.nsecondaries);
   }
   // add number of steps
   histNSteps->Fill(0.5, nSteps);
-  histNSteps->SetEntries(nSteps);
   histNStepsPerEvent->Fill(0.5, nSteps);
-  histNStepsPerEvent->SetEntries(nSteps);
+  nStepsTotal += nSteps;
 
   // add number of tracks
-  histNTracks->Fill(0.5, tracks.size());
-  histNTracks->SetEntries(tracks.size());
-  histNTracksPerEvent->Fill(0.5, tracks.size());
-  histNTracksPerEvent->SetEntries(tracks.size());
+  histNTracks->Fill(0.5, nTracks);
+  histNTracksPerEvent->Fill(0.5, nTracks);
+  nTracksTotal += nTracks;
   // update number of steps, number of steps per volume, mean step length and mean step length per volume
   float meanStepSizes = 0.;
   for (int i = 0; i < nStepsPerVol.size(); i++) {
     // if no step was made with that volume id, continue
-    if (nStepsPerVol[i] < 1) {
+    if (nStepsPerVol[i] <= 0.) {
       continue;
     }
     mAnalysisManager->getLookupVolName(i, volName);
@@ -214,12 +235,7 @@ void BasicMCAnalysis::analyze(const std::vector<StepInfo>* const steps, const st
       volPresent[volName]++;
     }
   }
-  histNStepsPerVolPerEvent->SetEntries(nSteps);
   histMeanStepSizePerEvent->Fill(0.5, meanStepSizes / float(nSteps));
-  // since the step size is the difference between 2 points in 3D space,
-  // the exact number of entries is nSteps-nTracks, however nTracks << nSteps is expected
-  histMeanStepSizePerEvent->SetEntries(nSteps);
-  histMeanStepSizePerVolPerEvent->SetEntries(nSteps);
   // number of steps per PDG ID and mean step length per PDG ID
   for (auto& sp : nStepsPerPDGMap) {
     std::string pdgString(std::to_string(sp.first));
@@ -233,8 +249,44 @@ void BasicMCAnalysis::analyze(const std::vector<StepInfo>* const steps, const st
       pdgPresent[pdgString]++;
     }
   }
-  histNStepsPerPDGPerEvent->SetEntries(nSteps);
-  histMeanStepSizePerPDGPerEvent->SetEntries(nSteps);
+  setEntries();
+}
+
+void BasicMCAnalysis::setEntries()
+{
+  // the entries count steps and tracks of all events; the fills above only count once per event
+  histNSteps->SetEntries(nStepsTotal);
+  histNStepsPerEvent->SetEntries(nStepsTotal);
+  histNTracks->SetEntries(nTracksTotal);
+  histNTracksPerEvent->SetEntries(nTracksTotal);
+  histNStepsPerVolPerEvent->SetEntries(nStepsTotal);
+  // since the step size is the difference between 2 points in 3D space,
+  // the exact number of entries is nSteps-nTracks, however nTracks << nSteps is expected
+  histMeanStepSizePerEvent->SetEntries(nStepsTotal);
+  histMeanStepSizePerVolPerEvent->SetEntries(nStepsTotal);
+  histNStepsPerPDGPerEvent->SetEntries(nStepsTotal);
+  histMeanStepSizePerPDGPerEvent->SetEntries(nStepsTotal);
+}
+
+void BasicMCAnalysis::merge(const MCAnalysis& other)
+{
+  auto& clone = static_cast<const BasicMCAnalysis&>(other);
+  for (auto volId : clone.volIds) {
+    if (std::find(volIds.begin(), volIds.end(), volId) == volIds.end()) {
+      volIds.push_back(volId);
+    }
+  }
+  for (auto& pp : clone.pdgPresent) {
+    pdgPresent[pp.first] += pp.second;
+  }
+  for (auto& vp : clone.volPresent) {
+    volPresent[vp.first] += vp.second;
+  }
+  // the merged histograms have summed the entries of the clone, they are set explicitly
+  // in order not to depend on how TH1::Merge counts them for labelled bins
+  nStepsTotal += clone.nStepsTotal;
+  nTracksTotal += clone.nTracksTotal;
+  setEntries();
 }
 
 void BasicMCAnalysis::finalize()
@@ -0,0 +1,884 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+
+//  @file   BinaryStepFormat.cxx
+//  @brief  compact binary encoding of steps and magnetic field calls
+
+#include "MCStepLogger/BinaryStepFormat.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include <RZip.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace o2
+{
+namespace
+{
+// size of the file header: magic (8 bytes) + version (4 bytes) + flags (4 bytes)
+constexpr std::size_t FILEHEADERSIZE = 16;
+// size of a chunk header: type (4 bytes) + payload size (8 bytes)
+constexpr std::size_t CHUNKHEADERSIZE = 12;
+// ROOT compresses at most this many bytes at once, each block carries a header of 9 bytes
+constexpr int MAXZIPBLOCK = 0xffffff;
+constexpr int ZIPHEADERSIZE = 9;
+// event flags
+constexpr uint64_t EVENTHASWEIGHTS = 1;
+constexpr uint64_t EVENTHASTIMING = 2;
+constexpr uint64_t EVENTHASFIELDTIMING = 4;
+
+//
+// encoding helpers, multi-byte values are always written little endian
+//
+void putFixed32(std::vector<char>& b, uint32_t v)
+{
+  for (int i = 0; i < 4; ++i) {
+    b.push_back(static_cast<char>(v >> (8 * i)));
+  }
+}
+
+void putFixed64(std::vector<char>& b, uint64_t v)
+{
+  for (int i = 0; i < 8; ++i) {
+    b.push_back(static_cast<char>(v >> (8 * i)));
+  }
+}
+
+void putVarint(std::vector<char>& b, uint64_t v)
+{
+  while (v >= 0x80) {
+    b.push_back(static_cast<char>(v | 0x80));
+    v >>= 7;
+  }
+  b.push_back(static_cast<char>(v));
+}
+
+// overwrite a value written before with putFixed64
+void setFixed64(std::vector<char>& b, std::size_t offset, uint64_t v)
+{
+  for (int i = 0; i < 8; ++i) {
+    b[offset + i] = static_cast<char>(v >> (8 * i));
+  }
+}
+
+void putZigzag(std::vector<char>& b, int64_t v)
+{
+  putVarint(b, (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63));
+}
+
+void putString(std::vector<char>& b, std::string const& s)
+{
+  putVarint(b, s.size());
+  b.insert(b.end(), s.begin(), s.end());
+}
+
+uint32_t floatBits(float f)
+{
+  uint32_t u;
+  std::memcpy(&u, &f, sizeof(u));
+  return u;
+}
+
+float bitsFloat(uint32_t u)
+{
+  float f;
+  std::memcpy(&f, &u, sizeof(f));
+  return f;
+}
+
+void putFloat(std::vector<char>& b, float f) { putFixed32(b, floatBits(f)); }
+
+// neighbouring values of one track have close bit patterns, hence small deltas
+void putFloatDelta(std::vector<char>& b, float f, uint32_t& previous)
+{
+  auto bits = floatBits(f);
+  putZigzag(b, static_cast<int32_t>(bits - previous));
+  previous = bits;
+}
+
+// IEEE 754 half precision, rounding to nearest even
+uint16_t floatToHalf(float f)
+{
+  auto bits = floatBits(f);
+  uint16_t sign = (bits >> 16) & 0x8000;
+  int exponent = static_cast<int>((bits >> 23) & 0xff) - 127 + 15;
+  uint32_t mantissa = bits & 0x7fffff;
+  if (((bits >> 23) & 0xff) == 0xff) {
+    // inf or nan
+    return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+  }
+  if (exponent >= 0x1f) {
+    // overflow
+    return sign | 0x7c00;
+  }
+  if (exponent <= 0) {
+    // subnormal or zero
+    if (exponent < -10) {
+      return sign;
+    }
+    mantissa |= 0x800000;
+    int shift = 14 - exponent;
+    uint32_t half = mantissa >> shift;
+    uint32_t rest = mantissa & ((1u << shift) - 1);
+    uint32_t halfway = 1u << (shift - 1);
+    if (rest > halfway || (rest == halfway && (half & 1))) {
+      half++;
+    }
+    return sign | half;
+  }
+  uint32_t half = (exponent << 10) | (mantissa >> 13);
+  uint32_t rest = mantissa & 0x1fff;
+  if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+    // may carry into the exponent which is still correct
+    half++;
+  }
+  return sign | half;
+}
+
+float halfToFloat(uint16_t h)
+{
+  uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+  uint32_t exponent = (h >> 10) & 0x1f;
+  uint32_t mantissa = h & 0x3ff;
+  if (exponent == 0x1f) {
+    return bitsFloat(sign | 0x7f800000 | (mantissa << 13));
+  }
+  if (exponent == 0) {
+    if (mantissa == 0) {
+      return bitsFloat(sign);
+    }
+    // normalize the subnormal
+    exponent = 127 - 15 + 1;
+    while ((mantissa & 0x400) == 0) {
+      mantissa <<= 1;
+      exponent--;
+    }
+    mantissa &= 0x3ff;
+    return bitsFloat(sign | (exponent << 23) | (mantissa << 13));
+  }
+  return bitsFloat(sign | ((exponent + 127 - 15) << 23) | (mantissa << 13));
+}
+
+//
+// decoding, any read beyond the end marks the cursor as bad
+//
+struct Cursor {
+  const unsigned char* p;
+  const unsigned char* end;
+  bool good = true;
+
+  Cursor(const char* data, std::size_t size)
+    : p(reinterpret_cast<const unsigned char*>(data)), end(reinterpret_cast<const unsigned char*>(data) + size) {}
+
+  uint32_t fixed32()
+  {
+    if (end - p < 4) {
+      good = false;
+      return 0;
+    }
+    uint32_t v = 0;
+    for (int i = 0; i < 4; ++i) {
+      v |= static_cast<uint32_t>(p[i]) << (8 * i);
+    }
+    p += 4;
+    return v;
+  }
+
+  uint64_t fixed64()
+  {
+    if (end - p < 8) {
+      good = false;
+      return 0;
+    }
+    uint64_t v = 0;
+    for (int i = 0; i < 8; ++i) {
+      v |= static_cast<uint64_t>(p[i]) << (8 * i);
+    }
+    p += 8;
+    return v;
+  }
+
+  uint64_t varint()
+  {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      if (p == end) {
+        good = false;
+        return 0;
+      }
+      auto byte = *p++;
+      v |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if ((byte & 0x80) == 0) {
+        return v;
+      }
+    }
+    good = false;
+    return 0;
+  }
+
+  int64_t zigzag()
+  {
+    auto v = varint();
+    return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+  }
+
+  float floating() { return bitsFloat(fixed32()); }
+
+  float floatDelta(uint32_t& previous)
+  {
+    previous += static_cast<uint32_t>(zigzag());
+    return bitsFloat(previous);
+  }
+
+  bool string(std::string& s)
+  {
+    auto size = varint();
+    if (!good || static_cast<uint64_t>(end - p) < size) {
+      good = false;
+      return false;
+    }
+    s.assign(reinterpret_cast<const char*>(p), size);
+    p += size;
+    return true;
+  }
+};
+
+// write names which have not been written to previous chunks,
+// names are interned, hence a different pointer means a different name
+void putNewNames(std::vector<char>& b, std::vector<std::string*> const& names, std::vector<const std::string*>& written)
+{
+  if (written.size() < names.size()) {
+    written.resize(names.size(), nullptr);
+  }
+  uint64_t nNew = 0;
+  for (std::size_t i = 0; i < names.size(); ++i) {
+    if (names[i] && names[i] != written[i]) {
+      nNew++;
+    }
+  }
+  putVarint(b, nNew);
+  for (std::size_t i = 0; i < names.size(); ++i) {
+    if (names[i] && names[i] != written[i]) {
+      putVarint(b, i);
+      putString(b, *names[i]);
+      written[i] = names[i];
+    }
+  }
+}
+
+template <typename Insert>
+bool getNewNames(Cursor& c, Insert insert)
+{
+  auto nNew = c.varint();
+  std::string name;
+  for (uint64_t i = 0; i < nNew && c.good; ++i) {
+    auto index = c.varint();
+    // the lookups grow up to the index, hence a corrupted index must not be followed
+    if (index > binaryformat::MAXLOOKUPINDEX) {
+      c.good = false;
+    }
+    if (c.good && c.string(name)) {
+      insert(index, name);
+    }
+  }
+  return c.good;
+}
+
+void putIntVector(std::vector<char>& b, std::vector<int> const& v)
+{
+  putVarint(b, v.size());
+  for (auto i : v) {
+    putZigzag(b, i);
+  }
+}
+
+bool getIntVector(Cursor& c, std::vector<int>& v)
+{
+  auto size = c.varint();
+  // every entry needs at least one byte
+  if (!c.good || size > static_cast<uint64_t>(c.end - c.p)) {
+    c.good = false;
+    return false;
+  }
+  v.resize(size);
+  for (auto& i : v) {
+    i = c.zigzag();
+  }
+  return c.good;
+}
+
+// per-track state (4 values per track), shared by the tracks without one of their own;
+// the track ids are read from the file, hence the state cannot grow beyond MAXTRACKSTATE tracks
+uint32_t* trackState(std::vector<uint32_t>& state, uint32_t* shared, int trackID)
+{
+  if (trackID < 0 || trackID >= binaryformat::MAXTRACKSTATE) {
+    return shared;
+  }
+  if (4 * static_cast<std::size_t>(trackID) + 4 > state.size()) {
+    state.resize(4 * static_cast<std::size_t>(trackID) + 4, 0);
+  }
+  return &state[4 * trackID];
+}
+
+// compress the payload of a complete chunk (header + payload) into out, see BinaryStepFormat.h
+void compressChunk(std::vector<char> const& chunk, std::vector<char>& out, int compression)
+{
+  auto payload = chunk.data() + CHUNKHEADERSIZE;
+  const std::size_t size = chunk.size() - CHUNKHEADERSIZE;
+  out.assign(chunk.begin(), chunk.begin() + 4);
+  putFixed64(out, 0);
+  putFixed64(out, size);
+  const auto start = out.size();
+  bool compressed = true;
+  for (std::size_t done = 0; done < size && compressed;) {
+    int n = static_cast<int>(std::min<std::size_t>(size - done, MAXZIPBLOCK));
+    int capacity = n + ZIPHEADERSIZE;
+    int written = 0;
+    auto offset = out.size();
+    out.resize(offset + capacity);
+    R__zip(compression, &n, const_cast<char*>(payload + done), &capacity, out.data() + offset, &written);
+    // ROOT gives up if a block does not get smaller
+    compressed = written > 0;
+    out.resize(offset + written);
+    done += n;
+  }
+  if (!compressed || out.size() - start >= size) {
+    out.resize(start);
+    out.insert(out.end(), payload, payload + size);
+  }
+  setFixed64(out, 4, out.size() - CHUNKHEADERSIZE);
+}
+
+// uncompress a chunk payload written by compressChunk, the block headers are checked
+// before anything is allocated since they are read from the file
+bool uncompressChunk(const char* payload, std::size_t size, const char*& data, std::size_t& dataSize,
+                     std::vector<char>& buffer)
+{
+  Cursor c(payload, size);
+  auto rawSize = c.fixed64();
+  if (!c.good) {
+    return false;
+  }
+  const std::size_t stored = c.end - c.p;
+  if (rawSize == stored) {
+    data = reinterpret_cast<const char*>(c.p);
+    dataSize = stored;
+    return true;
+  }
+  uint64_t total = 0;
+  for (auto p = c.p; p != c.end;) {
+    int blockSize = 0;
+    int blockRawSize = 0;
+    if (c.end - p < ZIPHEADERSIZE ||
+        R__unzip_header(&blockSize, const_cast<unsigned char*>(p), &blockRawSize) != 0 ||
+        blockSize <= ZIPHEADERSIZE || blockSize > c.end - p || blockRawSize <= 0) {
+      return false;
+    }
+    total += blockRawSize;
+    p += blockSize;
+  }
+  if (total != rawSize) {
+    return false;
+  }
+  buffer.resize(rawSize);
+  std::size_t done = 0;
+  for (auto p = c.p; p != c.end;) {
+    int blockSize = 0;
+    int blockRawSize = 0;
+    R__unzip_header(&blockSize, const_cast<unsigned char*>(p), &blockRawSize);
+    int unzipped = 0;
+    R__unzip(&blockSize, const_cast<unsigned char*>(p), &blockRawSize,
+             reinterpret_cast<unsigned char*>(buffer.data() + done), &unzipped);
+    if (unzipped != blockRawSize) {
+      return false;
+    }
+    done += unzipped;
+    p += blockSize;
+  }
+  data = buffer.data();
+  dataSize = buffer.size();
+  return true;
+}
+} // namespace
+
+void BinaryStepEncoder::encodeFileHeader(std::vector<char>& buffer, bool compressed) const
+{
+  buffer.insert(buffer.end(), binaryformat::MAGIC, binaryformat::MAGIC + sizeof(binaryformat::MAGIC));
+  putFixed32(buffer, binaryformat::VERSION);
+  putFixed32(buffer, (mFloat16Energy ? binaryformat::FLAGFLOAT16ENERGY : 0) |
+                       (compressed ? binaryformat::FLAGCOMPRESSED : 0));
+}
+
+void BinaryStepEncoder::encodeEvent(EventHeader const& header, std::vector<StepInfo> const& steps,
+                                    std::vector<MagCallInfo> const& calls, StepLookups const& lookups,
+                                    std::vector<char>& buffer, std::vector<TrackInfo> const* tracks)
+{
+  auto& b = mPayload;
+  b.clear();
+
+  putZigzag(b, header.eventid);
+  putVarint(b, header.workerid);
+  putVarint(b, (static_cast<uint64_t>(header.chunk) << 1) | (header.lastchunk ? 1 : 0));
+  putVarint(b, header.sampling);
+
+  // lookups, names only incrementally
+  putLookupNames(lookups);
+  putIntVector(b, lookups.tracktopdg);
+  putIntVector(b, lookups.tracktoparent);
+
+  bool hasWeights = false;
+  bool hasTiming = false;
+  for (auto& s : steps) {
+    hasWeights |= s.weight != 1.;
+    hasTiming |= s.cputime != 0.;
+  }
+  bool hasFieldTiming = false;
+  for (auto& c : calls) {
+    hasFieldTiming |= c.calltime != 0.;
+  }
+  putVarint(b, (hasWeights ? EVENTHASWEIGHTS : 0) | (hasTiming ? EVENTHASTIMING : 0) |
+                 (hasFieldTiming ? EVENTHASFIELDTIMING : 0));
+
+  // steps
+  mTrackState.clear();
+  uint32_t noTrackState[4] = { 0, 0, 0, 0 };
+  int prevStepId = -1;
+  int prevVolId = 0;
+  int prevTrackID = 0;
+  putVarint(b, steps.size());
+  for (auto& s : steps) {
+    putZigzag(b, static_cast<int64_t>(s.stepid) - prevStepId - 1);
+    putZigzag(b, static_cast<int64_t>(s.volId) - prevVolId);
+    putZigzag(b, s.copyNo);
+    putZigzag(b, static_cast<int64_t>(s.trackID) - prevTrackID);
+    prevStepId = s.stepid;
+    prevVolId = s.volId;
+    prevTrackID = s.trackID;
+
+    auto state = trackState(mTrackState, noTrackState, s.trackID);
+    putFloatDelta(b, s.x, state[0]);
+    putFloatDelta(b, s.y, state[1]);
+    putFloatDelta(b, s.z, state[2]);
+    if (mFloat16Energy) {
+      auto half = floatToHalf(s.E);
+      putZigzag(b, static_cast<int16_t>(half - static_cast<uint16_t>(state[3])));
+      state[3] = half;
+    } else {
+      putFloatDelta(b, s.E, state[3]);
+    }
+    putFloat(b, s.step);
+    putFloat(b, s.maxstep);
+    putVarint(b, s.nsecondaries);
+    for (int i = 0; i < s.nsecondaries; ++i) {
+      putZigzag(b, s.secondaryprocesses[i]);
+    }
+    putVarint(b, (static_cast<uint64_t>(s.nprocessesactive) << 1) | (s.stopped ? 1 : 0));
+    if (hasWeights) {
+      putFloat(b, s.weight);
+    }
+    putZigzag(b, s.firstprocess);
+    if (hasTiming) {
+      putFloat(b, s.cputime);
+    }
+  }
+
+  // magnetic field calls, delta-coded w.r.t. the previous call
+  long prevCallId = -1;
+  long prevCallStepId = -1;
+  uint32_t callState[3] = { 0, 0, 0 };
+  putVarint(b, calls.size());
+  for (auto& c : calls) {
+    putZigzag(b, c.id - prevCallId - 1);
+    putZigzag(b, c.stepid - prevCallStepId);
+    prevCallId = c.id;
+    prevCallStepId = c.stepid;
+    putFloatDelta(b, c.x, callState[0]);
+    putFloatDelta(b, c.y, callState[1]);
+    putFloatDelta(b, c.z, callState[2]);
+    putFloat(b, c.B);
+    if (hasWeights) {
+      putFloat(b, c.weight);
+    }
+    if (hasFieldTiming) {
+      putFloat(b, c.calltime);
+    }
+  }
+
+  // tracks in the order they were finished, track ids delta-coded
+  long prevTrackId = -1;
+  putVarint(b, tracks ? tracks->size() : 0);
+  if (tracks) {
+    for (auto& t : *tracks) {
+      putZigzag(b, static_cast<int64_t>(t.trackID) - prevTrackId);
+      prevTrackId = t.trackID;
+      putZigzag(b, t.pdg);
+      putZigzag(b, t.parent);
+      putZigzag(b, t.primary);
+      putFloat(b, t.x);
+      putFloat(b, t.y);
+      putFloat(b, t.z);
+      putFloat(b, t.E);
+      putVarint(b, t.nsteps);
+      putFloat(b, t.length);
+    }
+  }
+
+  putFixed32(buffer, binaryformat::CHUNKEVENT);
+  putFixed64(buffer, b.size());
+  buffer.insert(buffer.end(), b.begin(), b.end());
+}
+
+void BinaryStepEncoder::putLookupNames(StepLookups const& lookups)
+{
+  putNewNames(mPayload, lookups.volidtovolname, mVolNameWritten);
+  putNewNames(mPayload, lookups.volidtomodule, mModuleWritten);
+  putNewNames(mPayload, lookups.volidtomedium, mMediumWritten);
+  putNewNames(mPayload, lookups.volidtomaterial, mMaterialWritten);
+}
+
+void BinaryStepEncoder::encodeLookups(StepLookups const& lookups, std::vector<char>& buffer)
+{
+  mPayload.clear();
+  putLookupNames(lookups);
+  putFixed32(buffer, binaryformat::CHUNKLOOKUPS);
+  putFixed64(buffer, mPayload.size());
+  buffer.insert(buffer.end(), mPayload.begin(), mPayload.end());
+}
+
+bool BinaryStepDecoder::decodeEvent(const char* payload, std::size_t size, EventHeader& header,
+                                    std::vector<StepInfo>& steps, std::vector<MagCallInfo>& calls, StepLookups& lookups,
+                                    std::vector<TrackInfo>* tracks)
+{
+  Cursor c(payload, size);
+
+  header = EventHeader();
+  header.eventid = c.zigzag();
+  header.workerid = c.varint();
+  auto chunk = c.varint();
+  header.chunk = chunk >> 1;
+  header.lastchunk = chunk & 1;
+  header.sampling = c.varint();
+
+  if (!getNewNames(c, [&lookups](int i, std::string const& s) { lookups.insertVolName(i, s); }) ||
+      !getNewNames(c, [&lookups](int i, std::string const& s) { lookups.insertModuleName(i, s); }) ||
+      !getNewNames(c, [&lookups](int i, std::string const& s) { lookups.insertMediumName(i, s); }) ||
+      !getNewNames(c, [&lookups](int i, std::string const& s) { lookups.insertMaterialName(i, s); }) ||
+      !getIntVector(c, lookups.tracktopdg) || !getIntVector(c, lookups.tracktoparent)) {
+    return false;
+  }
+  auto eventFlags = c.varint();
+  bool hasWeights = eventFlags & EVENTHASWEIGHTS;
+  bool hasTiming = eventFlags & EVENTHASTIMING;
+  bool hasFieldTiming = eventFlags & EVENTHASFIELDTIMING;
+
+  // steps
+  auto nSteps = c.varint();
+  if (!c.good || nSteps > size) {
+    return false;
+  }
+  steps.resize(nSteps);
+  mTrackState.clear();
+  mSecondaryProcesses.clear();
+  mSecondaryOffsets.clear();
+  uint32_t noTrackState[4] = { 0, 0, 0, 0 };
+  int prevStepId = -1;
+  int prevVolId = 0;
+  int prevTrackID = 0;
+  for (auto& s : steps) {
+    s.stepid = prevStepId + 1 + c.zigzag();
+    s.volId = prevVolId + c.zigzag();
+    s.copyNo = c.zigzag();
+    s.trackID = prevTrackID + c.zigzag();
+    prevStepId = s.stepid;
+    prevVolId = s.volId;
+    prevTrackID = s.trackID;
+
+    auto state = trackState(mTrackState, noTrackState, s.trackID);
+    s.x = c.floatDelta(state[0]);
+    s.y = c.floatDelta(state[1]);
+    s.z = c.floatDelta(state[2]);
+    if (mFlags & binaryformat::FLAGFLOAT16ENERGY) {
+      state[3] = static_cast<uint16_t>(state[3] + c.zigzag());
+      s.E = halfToFloat(state[3]);
+    } else {
+      s.E = c.floatDelta(state[3]);
+    }
+    s.step = c.floating();
+    s.maxstep = c.floating();
+    // every secondary needs at least one byte
+    auto nSecondaries = c.varint();
+    if (nSecondaries > static_cast<uint64_t>(c.end - c.p)) {
+      return false;
+    }
+    s.nsecondaries = nSecondaries;
+    // pointers are set once all secondaries are read since the storage might still grow
+    mSecondaryOffsets.push_back(mSecondaryProcesses.size());
+    for (int i = 0; i < s.nsecondaries && c.good; ++i) {
+      mSecondaryProcesses.push_back(c.zigzag());
+    }
+    auto procs = c.varint();
+    s.nprocessesactive = procs >> 1;
+    s.stopped = procs & 1;
+    s.weight = hasWeights ? c.floating() : 1.;
+    s.firstprocess = c.zigzag();
+    s.cputime = hasTiming ? c.floating() : 0.;
+    if (!c.good) {
+      return false;
+    }
+  }
+  for (std::size_t i = 0; i < steps.size(); ++i) {
+    steps[i].secondaryprocesses = steps[i].nsecondaries > 0 ? mSecondaryProcesses.data() + mSecondaryOffsets[i] : nullptr;
+  }
+
+  // magnetic field calls
+  auto nCalls = c.varint();
+  if (!c.good || nCalls > size) {
+    return false;
+  }
+  calls.resize(nCalls);
+  long prevCallId = -1;
+  long prevCallStepId = -1;
+  uint32_t callState[3] = { 0, 0, 0 };
+  for (auto& call : calls) {
+    call.id = prevCallId + 1 + c.zigzag();
+    call.stepid = prevCallStepId + c.zigzag();
+    prevCallId = call.id;
+    prevCallStepId = call.stepid;
+    call.x = c.floatDelta(callState[0]);
+    call.y = c.floatDelta(callState[1]);
+    call.z = c.floatDelta(callState[2]);
+    call.B = c.floating();
+    call.weight = hasWeights ? c.floating() : 1.;
+    call.calltime = hasFieldTiming ? c.floating() : 0.;
+  }
+
+  // tracks
+  auto& trackRecords = tracks ? *tracks : mTracks;
+  trackRecords.clear();
+  auto nTracks = c.varint();
+  if (!c.good || nTracks > size) {
+    return false;
+  }
+  trackRecords.resize(nTracks);
+  long prevTrackId = -1;
+  for (auto& t : trackRecords) {
+    t.trackID = prevTrackId + c.zigzag();
+    prevTrackId = t.trackID;
+    t.pdg = c.zigzag();
+    t.parent = c.zigzag();
+    t.primary = c.zigzag();
+    t.x = c.floating();
+    t.y = c.floating();
+    t.z = c.floating();
+    t.E = c.floating();
+    t.nsteps = c.varint();
+    t.length = c.floating();
+  }
+  return c.good;
+}
+
+bool BinaryStepDecoder::decodeLookups(const char* payload, std::size_t size, StepLookups& lookups)
+{
+  Cursor c(payload, size);
+  return getNewNames(c, [&lookups](int i, std::string const& s) { lookups.insertVolName(i, s); }) &&
+         getNewNames(c, [&lookups](int i, std::string const& s) { lookups.insertModuleName(i, s); }) &&
+         getNewNames(c, [&lookups](int i, std::string const& s) { lookups.insertMediumName(i, s); }) &&
+         getNewNames(c, [&lookups](int i, std::string const& s) { lookups.insertMaterialName(i, s); });
+}
+
+BinaryStepWriter::~BinaryStepWriter()
+{
+  close();
+}
+
+bool BinaryStepWriter::open(std::string const& path, bool float16Energy, int compression)
+{
+  close();
+  mFile = std::fopen(path.c_str(), "wb");
+  if (!mFile) {
+    std::cerr << "[MCLOGGER:] CANNOT OPEN BINARY OUTPUT FILE " << path << "\n";
+    return false;
+  }
+  mEncoder = BinaryStepEncoder(float16Energy);
+  mCompression = compression < 0 ? binaryformat::DEFAULTCOMPRESSION : compression;
+  mBuffer.clear();
+  mEncoder.encodeFileHeader(mBuffer, mCompression > 0);
+  std::fwrite(mBuffer.data(), 1, mBuffer.size(), mFile);
+  return true;
+}
+
+void BinaryStepWriter::writeEvent(EventHeader const& header, std::vector<StepInfo> const& steps,
+                                  std::vector<MagCallInfo> const& calls, StepLookups const& lookups,
+                                  std::vector<TrackInfo> const* tracks)
+{
+  if (!mFile) {
+    return;
+  }
+  mBuffer.clear();
+  mEncoder.encodeEvent(header, steps, calls, lookups, mBuffer, tracks);
+  write();
+}
+
+void BinaryStepWriter::writeLookups(StepLookups const& lookups)
+{
+  if (!mFile) {
+    return;
+  }
+  mBuffer.clear();
+  mEncoder.encodeLookups(lookups, mBuffer);
+  write();
+}
+
+void BinaryStepWriter::write()
+{
+  auto& chunk = mCompression > 0 ? mCompressed : mBuffer;
+  if (mCompression > 0) {
+    compressChunk(mBuffer, mCompressed, mCompression);
+  }
+  if (std::fwrite(chunk.data(), 1, chunk.size(), mFile) != chunk.size()) {
+    std::cerr << "[MCLOGGER:] FAILED TO WRITE TO BINARY OUTPUT\n";
+  }
+}
+
+void BinaryStepWriter::close()
+{
+  if (mFile) {
+    std::fclose(mFile);
+    mFile = nullptr;
+  }
+}
+
+BinaryStepReader::~BinaryStepReader()
+{
+  close();
+}
+
+bool BinaryStepReader::isBinaryFile(std::string const& path)
+{
+  char magic[sizeof(binaryformat::MAGIC)];
+  auto f = std::fopen(path.c_str(), "rb");
+  if (!f) {
+    return false;
+  }
+  auto n = std::fread(magic, 1, sizeof(magic), f);
+  std::fclose(f);
+  return n == sizeof(magic) && std::memcmp(magic, binaryformat::MAGIC, sizeof(magic)) == 0;
+}
+
+bool BinaryStepReader::open(std::string const& path)
+{
+  close();
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    std::cerr << "ERROR: Cannot open file " << path << "\n";
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < FILEHEADERSIZE) {
+    std::cerr << "ERROR: File " << path << " is too small to be a binary step logger file\n";
+    ::close(fd);
+    return false;
+  }
+  auto data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping stays valid after the descriptor is closed
+  ::close(fd);
+  if (data == MAP_FAILED) {
+    std::cerr << "ERROR: Cannot map file " << path << "\n";
+    return false;
+  }
+  madvise(data, st.st_size, MADV_SEQUENTIAL);
+  mData = static_cast<const char*>(data);
+  mSize = st.st_size;
+
+  Cursor c(mData, mSize);
+  c.p += sizeof(binaryformat::MAGIC);
+  auto version = c.fixed32();
+  auto flags = c.fixed32();
+  if (std::memcmp(mData, binaryformat::MAGIC, sizeof(binaryformat::MAGIC)) != 0 || version != binaryformat::VERSION) {
+    std::cerr << "ERROR: File " << path << " is not a binary step logger file of version " << binaryformat::VERSION << "\n";
+    close();
+    return false;
+  }
+  mFlags = flags;
+  mDecoder = BinaryStepDecoder(flags);
+
+  // index the chunks, a truncated last chunk (e.g. crashed simulation) is ignored
+  while (c.p < c.end) {
+    auto type = c.fixed32();
+    auto size = c.fixed64();
+    if (!c.good || size > static_cast<uint64_t>(c.end - c.p)) {
+      std::cerr << "WARNING: Truncated chunk at the end of " << path << " is ignored\n";
+      break;
+    }
+    if (type == binaryformat::CHUNKEVENT || type == binaryformat::CHUNKLOOKUPS) {
+      mChunks.push_back({ type, reinterpret_cast<const char*>(c.p), static_cast<std::size_t>(size) });
+      mNEvents += type == binaryformat::CHUNKEVENT;
+    }
+    // unknown chunk types are skipped
+    c.p += size;
+  }
+  return true;
+}
+
+void BinaryStepReader::close()
+{
+  if (mData) {
+    munmap(const_cast<char*>(mData), mSize);
+  }
+  mData = nullptr;
+  mSize = 0;
+  mChunks.clear();
+  mNEvents = 0;
+  mNextChunk = 0;
+  mFlags = 0;
+}
+
+bool BinaryStepReader::payload(Chunk const& chunk, const char*& payload, std::size_t& size)
+{
+  if (mFlags & binaryformat::FLAGCOMPRESSED) {
+    return uncompressChunk(chunk.payload, chunk.size, payload, size, mUncompressed);
+  }
+  payload = chunk.payload;
+  size = chunk.size;
+  return true;
+}
+
+bool BinaryStepReader::readNextEvent(std::vector<StepInfo>& steps, std::vector<MagCallInfo>& calls, StepLookups& lookups,
+                                     EventHeader* header, std::vector<TrackInfo>* tracks)
+{
+  // lookups chunks preceding the event are decoded on the way
+  while (mNextChunk < mChunks.size()) {
+    auto& chunk = mChunks[mNextChunk++];
+    const char* data = nullptr;
+    std::size_t size = 0;
+    if (chunk.type == binaryformat::CHUNKLOOKUPS) {
+      if (!payload(chunk, data, size) || !mDecoder.decodeLookups(data, size, lookups)) {
+        std::cerr << "ERROR: Corrupted lookups chunk " << mNextChunk - 1 << "\n";
+        return false;
+      }
+      continue;
+    }
+    EventHeader h;
+    if (!payload(chunk, data, size) ||
+        !mDecoder.decodeEvent(data, size, header ? *header : h, steps, calls, lookups, tracks)) {
+      std::cerr << "ERROR: Corrupted event chunk " << mNextChunk - 1 << "\n";
+      return false;
+    }
+    return true;
+  }
+  return false;
+}
+} // end namespace o2
@@ -11,6 +11,8 @@
 #include "MCStepLogger/MCAnalysis.h"
 #include "MCStepLogger/MCAnalysisManager.h"
 
+#include "TClass.h"
+
 ClassImp(o2::mcstepanalysis::MCAnalysis);
 
 using namespace o2::mcstepanalysis;
@@ -22,4 +24,12 @@ MCAnalysis::MCAnalysis(const std::string& name)
   auto& anamgr = MCAnalysisManager::Instance();
   anamgr.registerAnalysis(this);
   mAnalysisManager = &anamgr;
-}
\ No newline at end of file
+}
+MCAnalysis* MCAnalysis::clone() const
+{
+  auto cl = TClass::GetClass(typeid(*this));
+  if (!cl || !cl->HasDefaultConstructor()) {
+    return nullptr;
+  }
+  return static_cast<MCAnalysis*>(cl->DynamicCast(MCAnalysis::Class(), cl->New()));
+}
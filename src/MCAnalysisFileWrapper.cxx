@@ -11,6 +11,7 @@
 #include <iostream>
 
 #include "TSystem.h" // to check for and create directories
+#include "TList.h"
 
 #include "MCStepLogger/MCAnalysisFileWrapper.h"
 #include "MCStepLogger/ROOTIOUtilities.h"
@@ -100,6 +101,22 @@ TH1* MCAnalysisFileWrapper::findHistogram(const std::string& name)
   return nullptr;
 }
 
+void MCAnalysisFileWrapper::merge(const MCAnalysisFileWrapper& other)
+{
+  for (auto& h : other.mHistograms) {
+    auto histogram = findHistogram(h->GetName());
+    if (!histogram) {
+      std::cerr << "WARNING: Histogram " << h->GetName() << " not present in analysis " << mAnalysisMetaInfo.analysisName << ", not merged\n";
+      continue;
+    }
+    // bins with labels are matched by label
+    TList list;
+    list.Add(h.get());
+    histogram->Merge(&list);
+  }
+  mHasChanged = true;
+}
+
 bool MCAnalysisFileWrapper::hasHistogram(const std::string& name)
 {
   return (findHistogram(name) != nullptr);
@@ -9,11 +9,19 @@
 // or submit itself to any jurisdiction.
 
 #include <iostream>
+#include <memory>
+#include <thread>
+
+#include "TFile.h"
+#include "TTree.h"
+#include "TROOT.h"
 
 #include "MCStepLogger/MCAnalysisManager.h"
 #include "MCStepLogger/MCAnalysis.h"
 #include "MCStepLogger/MCAnalysisFileWrapper.h"
 #include "MCStepLogger/ROOTIOUtilities.h"
+#include "MCStepLogger/BinaryStepFormat.h"
+#include "MCStepLogger/SharedMemoryStream.h"
 
 ClassImp(o2::mcstepanalysis::MCAnalysisManager);
 
@@ -29,6 +37,21 @@ void MCAnalysisManager::setInputFilepath(const std::string& filepath)
   mInputFilepath = filepath;
 }
 
+void MCAnalysisManager::setInputStream(const std::string& name)
+{
+  mInputStream = name;
+}
+
+void MCAnalysisManager::setEventSelection(const o2::EventSelection& selection)
+{
+  mEventSelection = selection;
+}
+
+void MCAnalysisManager::setNWorkers(int n)
+{
+  mNWorkers = n;
+}
+
 void MCAnalysisManager::registerAnalysis(MCAnalysis* analysis)
 {
   if (!mIsInitialized) {
@@ -45,8 +68,8 @@ void MCAnalysisManager::registerAnalysis(MCAnalysis* analysis)
 bool MCAnalysisManager::checkReadiness() const
 {
   std::string errorMessage;
-  if (mInputFilepath.empty()) {
-    errorMessage += "Input file required...\n";
+  if (mInputFilepath.empty() && mInputStream.empty() && !mIsOnline) {
+    errorMessage += "Input file or stream required...\n";
   }
   if (mLabel.empty()) {
     errorMessage += "Label required...\n";
@@ -65,7 +88,11 @@ void MCAnalysisManager::run(int nEvents)
     exit(1);
   }
   initialize();
-  analyze(nEvents);
+  if (mNWorkers > 1) {
+    analyzeParallel(nEvents);
+  } else {
+    analyze(nEvents);
+  }
   finalize();
 }
 
@@ -108,6 +135,34 @@ bool MCAnalysisManager::analyze(int nEvents, bool isDryrun)
     std::cerr << "Not yet initialized ==> nothing to analyze...\n";
     return false;
   }
+  // the binary format is recognised by its magic number, everything else is assumed to be a ROOT file
+  bool success = false;
+  if (!mEventSelection.empty() && (!mInputStream.empty() || o2::BinaryStepReader::isBinaryFile(mInputFilepath))) {
+    std::cerr << "FATAL: Events can only be selected in a ROOT file written with the StepLoggerIndex" << std::endl;
+    exit(1);
+  }
+  if (!mInputStream.empty()) {
+    success = analyzeStream(nEvents, isDryrun);
+  } else if (o2::BinaryStepReader::isBinaryFile(mInputFilepath)) {
+    success = analyzeBinary(nEvents, isDryrun);
+  } else {
+    success = analyzeTTree(nEvents, isDryrun);
+  }
+  if (!success) {
+    return false;
+  }
+  if (!isDryrun) {
+    std::cerr << "INFO: Analysis run on " << (mInputStream.empty() ? "file " + mInputFilepath : "stream " + mInputStream) << " done.\n";
+    mIsAnalyzed = true;
+  } else {
+    mCurrentEventNumber = 0;
+    mNSteps = 0;
+  }
+  return true;
+}
+
+bool MCAnalysisManager::analyzeTTree(int nEvents, bool isDryrun)
+{
   // taking only the first entry is a hack! \todo change this by enabling also for TChains
   ROOTIOUtilities rootutil(mInputFilepath);
 
@@ -127,7 +182,25 @@ bool MCAnalysisManager::analyze(int nEvents, bool isDryrun)
 
   // prepare variables and connect to branches
   // \todo align branch names with MCStepLogger and get rid of hard coded names
-  if (!rootutil.setBranch("Steps", &mCurrentStepInfo) || !rootutil.setBranch("Calls", &mCurrentMagCallInfo) || !rootutil.setBranch("Lookups", &mCurrentLookups)) {
+  // field calls are either logged one by one or aggregated per step
+  mHasStoredCallSummaries = rootutil.hasBranch("CallSummaries");
+  if (mHasStoredCallSummaries) {
+    mCurrentMagCallInfo = &mNoMagCalls;
+  }
+  // names of all volumes written once per file, older files only have the per-event lookups
+  mRunLookups = o2::StepLookups();
+  rootutil.readObject(mRunLookups, "RunLookups");
+  // the header is missing in older files, events are then never chunked
+  if (rootutil.hasBranch("Header")) {
+    rootutil.setBranch("Header", &mCurrentEventHeader);
+  }
+  // so are the tracks, also if the track boundaries were not intercepted
+  if (rootutil.hasBranch("Tracks")) {
+    rootutil.setBranch("Tracks", &mCurrentTracks);
+  }
+  if (!rootutil.setBranch("Steps", &mCurrentStepInfo) ||
+      !(mHasStoredCallSummaries ? rootutil.setBranch("CallSummaries", &mCurrentCallSummaries) : rootutil.setBranch("Calls", &mCurrentMagCallInfo)) ||
+      !rootutil.setBranch("Lookups", &mCurrentLookups)) {
     rootutil.close();
     if (isDryrun) {
       return false;
@@ -135,13 +208,35 @@ bool MCAnalysisManager::analyze(int nEvents, bool isDryrun)
     std::cerr << "FATAL: Cannot find required branches in TTree " << mAnalysisTreename << std::endl;
     exit(1);
   }
+  // the selected events are looked up in the index, their entries are read in the order they were written;
+  // workers get theirs assigned
+  std::vector<long> selectedEntries = mEntries;
+  const bool isSelected = mIsWorker || !mEventSelection.empty();
+  if (!mIsWorker && isSelected) {
+    o2::StepLoggerIndex index;
+    if (!readIndex(index, false)) {
+      rootutil.close();
+      std::cerr << "FATAL: Cannot select events, there is no StepLoggerIndex in file " << mInputFilepath << std::endl;
+      exit(1);
+    }
+    selectedEntries = mEventSelection.selectEntries(index);
+    std::cerr << "INFO: " << selectedEntries.size() << " entries of " << index.entries.size() << " selected\n";
+  }
+  std::size_t nextSelected = 0;
+  auto nextEntry = [&]() {
+    if (!isSelected) {
+      return rootutil.processTTree();
+    }
+    return nextSelected < selectedEntries.size() && rootutil.processTTree(selectedEntries[nextSelected++]);
+  };
   // process tree and analyze
-  while (rootutil.processTTree()) {
+  while (nextEntry()) {
     if (nEvents <= mCurrentEventNumber && nEvents > 0) {
       break;
     }
     // check whether all pointers to MCStepLogger branches are set...
-    if (mCurrentStepInfo == nullptr || mCurrentMagCallInfo == nullptr || mCurrentLookups == nullptr) {
+    if (mCurrentStepInfo == nullptr || mCurrentMagCallInfo == nullptr || mCurrentLookups == nullptr ||
+        (mHasStoredCallSummaries && mCurrentCallSummaries == nullptr)) {
       rootutil.close();
       if (isDryrun) {
         return false;
@@ -149,33 +244,417 @@ bool MCAnalysisManager::analyze(int nEvents, bool isDryrun)
       std::cerr << "FATAL: Obtained nullptrs while processing TTree " << mAnalysisTreename << std::endl;
       exit(1);
     }
+    // names are only written with the first event they appear in
+    mRunLookups.mergeNames(*mCurrentLookups);
     // ... if so, next event
-    mCurrentEventNumber++;
-    mNSteps += mCurrentStepInfo->size();
+    analyzeEvent(isDryrun);
+  }
+  rootutil.close();
+  resetCurrentEvent();
+  return true;
+}
 
-    std::cout << "---> Event " << mCurrentEventNumber << " <---\n";
-    std::cout << "#steps: " << mCurrentStepInfo->size() << "\n";
-    std::cout << "#mag field calls: " << mCurrentMagCallInfo->size() << "\n";
+bool MCAnalysisManager::analyzeParallel(int nEvents)
+{
+  // the workers read the file independently, a binary file or stream can only be read sequentially
+  if (!mInputStream.empty() || o2::BinaryStepReader::isBinaryFile(mInputFilepath)) {
+    std::cerr << "WARNING: Only ROOT files can be analysed in parallel, analysing sequentially\n";
+    return analyze(nEvents);
+  }
+  if (!mIsInitialized) {
+    std::cerr << "Not yet initialized ==> nothing to analyze...\n";
+    return false;
+  }
+  // before any file is opened by the workers
+  ROOT::EnableThreadSafety();
+  o2::StepLoggerIndex index;
+  if (!readIndex(index, mEventSelection.empty())) {
+    std::cerr << "FATAL: Cannot " << (mEventSelection.empty() ? "read tree " + mAnalysisTreename : "select events, there is no StepLoggerIndex")
+              << " in file " << mInputFilepath << std::endl;
+    exit(1);
+  }
+  // an empty selection keeps all events, complete events are assigned to a worker
+  auto events = mEventSelection.select(index);
+  if (nEvents > 0 && nEvents < events.size()) {
+    events.resize(nEvents);
+  }
+  auto partitions = o2::partitionEvents(events, mNWorkers);
+
+  // the histograms of the clones are owned by their workers only
+  const bool addDirectory = TH1::AddDirectoryStatus();
+  TH1::AddDirectory(false);
+  std::vector<std::unique_ptr<MCAnalysisManager>> workers;
+  bool isCloned = true;
+  for (auto& entries : partitions) {
+    if (entries.empty()) {
+      continue;
+    }
+    workers.emplace_back(new MCAnalysisManager());
+    auto& worker = workers.back();
+    worker->mInputFilepath = mInputFilepath;
+    worker->mAnalysisTreename = mAnalysisTreename;
+    worker->mLabel = mLabel;
+    worker->mIsWorker = true;
+    worker->mEntries = entries;
+    for (auto& a : mAnalyses) {
+      auto clone = a->clone();
+      if (!clone) {
+        std::cerr << "WARNING: Analysis " << a->name() << " cannot be cloned, analysing sequentially\n";
+        isCloned = false;
+        break;
+      }
+      clone->mAnalysisManager = worker.get();
+      worker->mAnalyses.push_back(clone);
+    }
+    if (!isCloned) {
+      break;
+    }
+    worker->initialize();
+  }
+  TH1::AddDirectory(addDirectory);
+  if (!isCloned) {
+    for (auto& w : workers) {
+      for (auto& a : w->mAnalyses) {
+        delete a;
+      }
+    }
+    return analyze(nEvents);
+  }
+
+  std::cerr << "INFO: Analysing " << events.size() << " events in " << workers.size() << " threads\n";
+  std::vector<std::thread> threads;
+  for (auto& w : workers) {
+    threads.emplace_back([&w]() { w->analyzeTTree(-1, false); });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  // analyses and their files are in the same order for all managers
+  for (auto& w : workers) {
+    for (std::size_t i = 0; i < mAnalyses.size(); ++i) {
+      mAnalysisFiles[i].merge(w->mAnalysisFiles[i]);
+      mAnalyses[i]->merge(*w->mAnalyses[i]);
+      delete w->mAnalyses[i];
+    }
+    mCurrentEventNumber += w->mCurrentEventNumber;
+    mNSteps += w->mNSteps;
+    mRunLookups.mergeNames(w->mRunLookups);
+  }
+  std::cerr << "INFO: Analysis run on file " << mInputFilepath << " done.\n";
+  mIsAnalyzed = true;
+  return true;
+}
+
+bool MCAnalysisManager::readIndex(o2::StepLoggerIndex& index, bool fromHeaders) const
+{
+  std::unique_ptr<TFile> file(TFile::Open(mInputFilepath.c_str(), "READ"));
+  TTree* tree = nullptr;
+  if (file && !file->IsZombie()) {
+    file->GetObject(mAnalysisTreename.c_str(), tree);
+  }
+  if (!tree) {
+    return false;
+  }
+  o2::StepLoggerIndex* stored = nullptr;
+  file->GetObject("StepLoggerIndex", stored);
+  if (stored) {
+    index = *stored;
+    delete stored;
+    return true;
+  }
+  if (!fromHeaders) {
+    return false;
+  }
+  // without sizes, older files without header have one complete event per entry
+  index.entries.clear();
+  const bool hasHeader = tree->GetBranch("Header") != nullptr;
+  o2::EventHeader* header = nullptr;
+  if (hasHeader) {
+    tree->SetBranchStatus("*", false);
+    tree->SetBranchStatus("Header", true);
+    tree->SetBranchAddress("Header", &header);
+  }
+  for (Long64_t entry = 0; entry < tree->GetEntries(); ++entry) {
+    o2::EventIndexEntry e;
+    e.entry = entry;
+    e.eventid = entry;
+    if (hasHeader && tree->GetEntry(entry) > 0) {
+      e.eventid = header->eventid;
+      e.workerid = header->workerid;
+      e.chunk = header->chunk;
+      e.lastchunk = header->lastchunk;
+    }
+    index.entries.push_back(e);
+  }
+  tree->ResetBranchAddresses();
+  delete header;
+  return true;
+}
+
+bool MCAnalysisManager::analyzeBinary(int nEvents, bool isDryrun)
+{
+  o2::BinaryStepReader reader;
+  if (!reader.open(mInputFilepath)) {
+    if (isDryrun) {
+      return false;
+    }
+    std::cerr << "FATAL: Cannot read binary file " << mInputFilepath << std::endl;
+    exit(1);
+  }
+  if (nEvents > reader.nEvents()) {
+    std::cerr << "WARNING: You want to process " << nEvents << ", however only " << reader.nEvents() << " are present.\n";
+  }
+  // containers are reused for all events, the lookups are accumulated
+  std::vector<o2::StepInfo> steps;
+  std::vector<o2::MagCallInfo> calls;
+  o2::StepLookups lookups;
+  std::vector<o2::TrackInfo> tracks;
+  mCurrentStepInfo = &steps;
+  mCurrentMagCallInfo = &calls;
+  o2::EventHeader header;
+  mCurrentLookups = &lookups;
+  mCurrentEventHeader = &header;
+  mCurrentTracks = &tracks;
+  mHasStoredCallSummaries = false;
+  while (nEvents <= 0 || mCurrentEventNumber < nEvents) {
+    if (!reader.readNextEvent(steps, calls, lookups, &header, &tracks)) {
+      break;
+    }
+    analyzeEvent(isDryrun);
+  }
+  // do not leave pointers to local containers behind
+  resetCurrentEvent();
+  return true;
+}
+
+bool MCAnalysisManager::analyzeStream(int nEvents, bool isDryrun)
+{
+  o2::SharedMemoryStreamReader reader;
+  if (!reader.attach(mInputStream)) {
+    if (isDryrun) {
+      return false;
+    }
+    std::cerr << "FATAL: Cannot attach to stream " << mInputStream << std::endl;
+    exit(1);
+  }
+  // containers are reused for all events, the lookups are accumulated
+  std::vector<o2::StepInfo> steps;
+  std::vector<o2::MagCallInfo> calls;
+  o2::StepLookups lookups;
+  std::vector<o2::TrackInfo> tracks;
+  mCurrentStepInfo = &steps;
+  mCurrentMagCallInfo = &calls;
+  o2::EventHeader header;
+  mCurrentLookups = &lookups;
+  mCurrentEventHeader = &header;
+  mCurrentTracks = &tracks;
+  mHasStoredCallSummaries = false;
+  // events are analysed as they arrive until the simulation ends
+  while (nEvents <= 0 || mCurrentEventNumber < nEvents) {
+    if (!reader.readNextEvent(steps, calls, lookups, &header, &tracks)) {
+      break;
+    }
+    analyzeEvent(isDryrun);
+  }
+  if (reader.nDropped() > 0) {
+    std::cerr << "WARNING: " << reader.nDropped() << " events were dropped by the MCStepLogger and are not analysed\n";
+  }
+  reader.detach();
+  // do not leave pointers to local containers behind
+  resetCurrentEvent();
+  return true;
+}
+
+void MCAnalysisManager::analyzeEvent(bool isDryrun)
+{
+  // analyses only interested in the aggregated field calls get them in any case
+  if (!mHasStoredCallSummaries) {
+    o2::MagCallSummary::summarize(*mCurrentMagCallInfo, mDerivedCallSummaries);
+    mCurrentCallSummaries = &mDerivedCallSummaries;
+  }
+  mEventSteps = mCurrentStepInfo;
+  mEventMagCalls = mCurrentMagCallInfo;
+  mEventCallSummaries = mCurrentCallSummaries;
+  mEventLookups = mCurrentLookups;
+  mEventTracks = mCurrentTracks ? mCurrentTracks : &mNoTracks;
+
+  // events exceeding the memory budget of the MCStepLogger come in several chunks
+  const bool isChunked = mCurrentEventHeader && (mCurrentEventHeader->chunk > 0 || !mCurrentEventHeader->lastchunk);
+  const std::pair<int, int> eventKey = isChunked ? std::make_pair(mCurrentEventHeader->workerid, mCurrentEventHeader->eventid) : std::make_pair(0, 0);
+  mChunkStepOffset = 0;
+  if (isChunked) {
+    auto stitched = mStitchedEvents.find(eventKey);
+    if (stitched != mStitchedEvents.end()) {
+      mChunkStepOffset = stitched->second.steps.size();
+    }
+    // chunk-aware analyses get each chunk as it comes...
     if (!isDryrun) {
-      std::cout << "\nStart..." << std::endl;
       for (auto& a : mAnalyses) {
+        if (a->isChunkAware()) {
+          a->analyze(mEventSteps, mEventMagCalls);
+        }
+      }
+    }
+    // ...all others the event stitched together from its chunks
+    stitchChunk();
+    if (!mCurrentEventHeader->lastchunk) {
+      return;
+    }
+    auto& event = mStitchedEvents[eventKey];
+    mEventSteps = &event.steps;
+    mEventMagCalls = &event.magCalls;
+    mEventCallSummaries = &event.callSummaries;
+    mEventLookups = &event.lookups;
+    mEventTracks = &event.tracks;
+    mChunkStepOffset = 0;
+  }
+  lookupsFromTracks();
+
+  mCurrentEventNumber++;
+  mNSteps += mEventSteps->size();
+  long nCalls = 0;
+  for (auto& summary : *mEventCallSummaries) {
+    nCalls += summary.ncalls;
+  }
+
+  // do not flood the output of the simulation, nor interleave that of the workers
+  const bool isVerbose = !mIsOnline && !mIsWorker;
+  if (isVerbose) {
+    std::cout << "---> Event " << mCurrentEventNumber << " <---\n";
+    std::cout << "#steps: " << mEventSteps->size() << "\n";
+    std::cout << "#mag field calls: " << nCalls << "\n";
+  }
+  if (!isDryrun) {
+    if (isVerbose) {
+      std::cout << "\nStart..." << std::endl;
+    }
+    for (auto& a : mAnalyses) {
+      if (isChunked && a->isChunkAware()) {
+        continue;
+      }
+      if (isVerbose) {
         std::cout << "\t\tCall analysis " << a->name() << std::endl;
-        a->analyze(mCurrentStepInfo, mCurrentMagCallInfo);
       }
+      a->analyze(mEventSteps, mEventMagCalls);
+    }
+    if (isVerbose) {
       std::cout << "Done\n";
     }
   }
-  rootutil.close();
-  if (!isDryrun) {
-    std::cerr << "INFO: Analysis run on file " << mInputFilepath << " done.\n";
-    mIsAnalyzed = true;
-  } else {
-    mCurrentEventNumber = 0;
-    mNSteps = 0;
+  if (isChunked) {
+    mStitchedEvents.erase(eventKey);
+    mEventSteps = nullptr;
+    mEventMagCalls = nullptr;
+    mEventCallSummaries = nullptr;
+    mEventLookups = nullptr;
+    mEventTracks = nullptr;
+  }
+}
+
+void MCAnalysisManager::resetCurrentEvent()
+{
+  for (auto& event : mStitchedEvents) {
+    std::cerr << "WARNING: Event " << event.first.second << " of worker " << event.first.first << " is incomplete, its "
+              << event.second.steps.size() << " steps are not analysed\n";
+  }
+  mStitchedEvents.clear();
+  mChunkStepOffset = 0;
+  mCurrentStepInfo = nullptr;
+  mCurrentMagCallInfo = nullptr;
+  mCurrentCallSummaries = nullptr;
+  mCurrentLookups = nullptr;
+  mCurrentEventHeader = nullptr;
+  mCurrentTracks = nullptr;
+  mEventSteps = nullptr;
+  mEventMagCalls = nullptr;
+  mEventCallSummaries = nullptr;
+  mEventLookups = nullptr;
+  mEventTracks = nullptr;
+}
+
+void MCAnalysisManager::stitchChunk()
+{
+  auto& event = mStitchedEvents[{ mCurrentEventHeader->workerid, mCurrentEventHeader->eventid }];
+  // the containers are overwritten by the next chunk, hence everything is copied
+  // including the secondary processes of the steps
+  for (auto& step : *mCurrentStepInfo) {
+    event.steps.push_back(step);
+    if (step.nsecondaries > 0 && step.secondaryprocesses) {
+      auto& copy = event.steps.back();
+      copy.secondaryprocesses = event.arena.allocate(step.nsecondaries);
+      std::copy(step.secondaryprocesses, step.secondaryprocesses + step.nsecondaries, copy.secondaryprocesses);
+    }
+  }
+  event.magCalls.insert(event.magCalls.end(), mCurrentMagCallInfo->begin(), mCurrentMagCallInfo->end());
+  event.callSummaries.insert(event.callSummaries.end(), mCurrentCallSummaries->begin(), mCurrentCallSummaries->end());
+  // each chunk only knows the tracks of its steps or those finished within it
+  event.lookups.merge(*mCurrentLookups);
+  if (mCurrentTracks) {
+    event.tracks.insert(event.tracks.end(), mCurrentTracks->begin(), mCurrentTracks->end());
+  }
+}
+
+void MCAnalysisManager::lookupsFromTracks()
+{
+  // with track records the MCStepLogger does not fill the PDG and parent lookups per step
+  for (auto& track : *mEventTracks) {
+    if (track.trackID < 0) {
+      continue;
+    }
+    mEventLookups->insertPDG(track.trackID, track.pdg);
+    mEventLookups->insertParent(track.trackID, track.parent);
+  }
+}
+
+bool MCAnalysisManager::startOnline()
+{
+  mIsOnline = true;
+  if (!checkReadiness()) {
+    mIsOnline = false;
+    return false;
   }
+  initialize();
   return true;
 }
 
+void MCAnalysisManager::analyzeOnline(std::vector<o2::StepInfo>* steps, std::vector<o2::MagCallInfo>* calls,
+                                      o2::StepLookups* lookups, o2::EventHeader* header,
+                                      std::vector<o2::TrackInfo>* tracks)
+{
+  if (!mIsOnline) {
+    std::cerr << "ERROR: Online mode not started ==> event not analysed\n";
+    return;
+  }
+  mCurrentStepInfo = steps;
+  mCurrentMagCallInfo = calls;
+  mCurrentLookups = lookups;
+  mCurrentEventHeader = header;
+  mCurrentTracks = tracks;
+  mHasStoredCallSummaries = false;
+  analyzeEvent(false);
+  // the containers belong to the simulation, chunks of an unfinished event are kept stitched
+  mCurrentStepInfo = nullptr;
+  mCurrentMagCallInfo = nullptr;
+  mCurrentCallSummaries = nullptr;
+  mCurrentLookups = nullptr;
+  mCurrentEventHeader = nullptr;
+  mCurrentTracks = nullptr;
+}
+
+void MCAnalysisManager::finishOnline(const std::string& directory)
+{
+  if (!mIsOnline) {
+    return;
+  }
+  resetCurrentEvent();
+  std::cerr << "INFO: Online analysis of " << mCurrentEventNumber << " events done.\n";
+  mIsAnalyzed = true;
+  finalize();
+  write(directory);
+  mIsOnline = false;
+}
+
 void MCAnalysisManager::finalize()
 {
   if (!mIsAnalyzed) {
@@ -199,17 +678,23 @@ void MCAnalysisManager::terminate()
   //std::cerr << "Terminate MCAnalysisManager...";
   mIsInitialized = false;
   mIsAnalyzed = false;
+  mIsOnline = false;
   mCurrentEventNumber = 0;
   mNSteps = 0;
-  mCurrentStepInfo = nullptr;
-  mCurrentMagCallInfo = nullptr;
-  mCurrentLookups = nullptr;
+  mHasStoredCallSummaries = false;
+  mRunLookups = o2::StepLookups();
+  resetCurrentEvent();
   // tell each analysis to terminat/reset
   for (auto& a : mAnalyses) {
     a->isInitialized(false);
   }
 }
 
+void MCAnalysisManager::setRunLookups(const o2::StepLookups& lookups)
+{
+  mRunLookups = lookups;
+}
+
 void MCAnalysisManager::setLabel(const std::string& label)
 {
   mLabel = label;
@@ -233,56 +718,81 @@ int MCAnalysisManager::getEventNumber() const
   return mCurrentEventNumber;
 }
 
-void MCAnalysisManager::getLookupVolName(int volId, std::string& name) const
+const std::string* MCAnalysisManager::getLookupName(std::vector<std::string*> o2::StepLookups::*names, int volId) const
 {
-  if (volId > -1 && volId < mCurrentLookups->volidtovolname.size()) {
-    if (mCurrentLookups->volidtovolname[volId] != nullptr ||
-        mCurrentLookups->volidtovolname[volId]->size() != 0) {
-      name = *(mCurrentLookups->volidtovolname[volId]);
-      return;
+  if (volId < 0) {
+    return nullptr;
+  }
+  // the lookups of the event take precedence over those of the run
+  for (auto lookups : { static_cast<const o2::StepLookups*>(mEventLookups), &mRunLookups }) {
+    if (lookups && volId < (lookups->*names).size()) {
+      auto name = (lookups->*names)[volId];
+      if (name != nullptr && name->size() != 0) {
+        return name;
+      }
     }
   }
-  name = "UNKNOWNVOLNAME";
+  return nullptr;
+}
+
+void MCAnalysisManager::getLookupVolName(int volId, std::string& name) const
+{
+  auto lookup = getLookupName(&o2::StepLookups::volidtovolname, volId);
+  name = lookup ? *lookup : "UNKNOWNVOLNAME";
 }
 
 void MCAnalysisManager::getLookupModName(int volId, std::string& name) const
 {
-  if (volId > -1 && volId < mCurrentLookups->volidtomodule.size()) {
-    if (mCurrentLookups->volidtomodule[volId] != nullptr ||
-        mCurrentLookups->volidtomodule[volId]->size() != 0) {
-      name = *(mCurrentLookups->volidtomodule[volId]);
-      return;
-    }
-  }
-  name = "UNKNOWNMODNAME";
+  auto lookup = getLookupName(&o2::StepLookups::volidtomodule, volId);
+  name = lookup ? *lookup : "UNKNOWNMODNAME";
 }
 
 void MCAnalysisManager::getLookupMedName(int volId, std::string& name) const
 {
-  if (volId > -1 && volId < mCurrentLookups->volidtomedium.size()) {
-    if (mCurrentLookups->volidtomedium[volId] != nullptr ||
-        mCurrentLookups->volidtomedium[volId]->size() != 0) {
-      name = *(mCurrentLookups->volidtomedium[volId]);
-      return;
-    }
-  }
-  name = "UNKNOWNMEDNAME";
+  auto lookup = getLookupName(&o2::StepLookups::volidtomedium, volId);
+  name = lookup ? *lookup : "UNKNOWNMEDNAME";
+}
+
+void MCAnalysisManager::getLookupMatName(int volId, std::string& name) const
+{
+  auto lookup = getLookupName(&o2::StepLookups::volidtomaterial, volId);
+  name = lookup ? *lookup : "UNKNOWNMATNAME";
 }
 
 void MCAnalysisManager::getLookupPDG(int trackId, int& id) const
 {
-  if (trackId > -1 && trackId < mCurrentLookups->tracktopdg.size()) {
-    id = mCurrentLookups->tracktopdg[trackId];
+  if (trackId > -1 && trackId < mEventLookups->tracktopdg.size()) {
+    id = mEventLookups->tracktopdg[trackId];
     return;
   }
   id = -2;
 }
 
+const std::vector<o2::MagCallSummary>* MCAnalysisManager::getCallSummaries() const
+{
+  return mEventCallSummaries;
+}
+
+const o2::EventHeader* MCAnalysisManager::getEventHeader() const
+{
+  return mCurrentEventHeader;
+}
+
+long MCAnalysisManager::getChunkStepOffset() const
+{
+  return mChunkStepOffset;
+}
+
+const std::vector<o2::TrackInfo>* MCAnalysisManager::getTracks() const
+{
+  return mEventTracks;
+}
+
 void MCAnalysisManager::getLookupParent(int trackId, int& parentId) const
 {
   parentId = -2;
-  if (trackId > -1 && trackId < mCurrentLookups->tracktoparent.size()) {
-    parentId = mCurrentLookups->tracktoparent[trackId];
+  if (trackId > -1 && trackId < mEventLookups->tracktoparent.size()) {
+    parentId = mEventLookups->tracktoparent[trackId];
     return;
   }
 }
@@ -13,8 +13,10 @@
 //  @since  2017-06-29
 //  @brief  A LD_PRELOAD logger hooking into Stepping of TVirtualMCApplication's
 
-class TVirtualMCApplication;
-class TVirtualMagField;
+#include <TVirtualMCApplication.h>
+#include <TVirtualMagField.h>
+#include <cstring>
+#include "MCStepLogger/CycleClock.h"
 
 // (re)declare symbols to be able to hook into them
 #define DECLARE_INTERCEPT_SYMBOLS(APP) \
@@ -24,6 +26,8 @@ class TVirtualMagField;
     void Stepping();                   \
     void FinishEvent();                \
     void ConstructGeometry();          \
+    void PreTrack();                   \
+    void PostTrack();                  \
   };
 
 DECLARE_INTERCEPT_SYMBOLS(FairMCApplication)
@@ -47,36 +51,93 @@ DECLARE_INTERCEPT_FIELD_SYMBOLS(MagneticField);
 DECLARE_INTERCEPT_FIELD_SYMBOLS(AliMagF);
 
 extern "C" void performLogging(TVirtualMCApplication*);
-extern "C" void logField(const double*, const double*);
-extern "C" void dispatchOriginal(TVirtualMCApplication*, char const* libname, char const*);
-extern "C" void dispatchOriginalField(TVirtualMagField*, char const* libname, char const*, const double x[3],
-                                      double* B);
+extern "C" void logField(const double*, const double*, unsigned long long);
+extern "C" void* resolveOriginalSymbol(char const* libname, char const* origFunctionName);
 extern "C" void flushLog();
+extern "C" void beginTrack();
+extern "C" void endTrack();
 extern "C" void initLogger();
+extern "C" bool isLoggerInstrumented();
+extern "C" void addOriginalSteppingCycles(unsigned long long);
+extern "C" bool isFieldTimed();
 
-#define INTERCEPT_STEPPING(APP, LIB, SYMBOL)                       \
-  void APP::Stepping()                                             \
-  {                                                                \
-    auto baseptr = reinterpret_cast<TVirtualMCApplication*>(this); \
-    performLogging(baseptr);                                       \
-    dispatchOriginal(baseptr, LIB, SYMBOL);                        \
+typedef void (TVirtualMCApplication::*StepMethodType)();
+typedef void (TVirtualMagField::*FieldMethodType)(const double[3], double*);
+
+// turn the address of an original symbol into a member function pointer
+template <typename MethodType>
+MethodType getOriginalMethod(char const* libname, char const* origFunctionName)
+{
+  MethodType origMethod = nullptr;
+  void* symbolAddress = resolveOriginalSymbol(libname, origFunctionName);
+// Purposely ignore compiler warning
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wsizeof-pointer-memaccess"
+  // hack since C++ does not allow casting to C++ member function pointers
+  // thanks to gist.github.com/mooware/1174572
+  memcpy(&origMethod, &symbolAddress, sizeof(&symbolAddress));
+#pragma GCC diagnostic pop
+  return origMethod;
+}
+
+// Each intercepted method resolves its original symbol once at first use and keeps it
+// in a static member function pointer, every later call goes directly through that pointer.
+
+// If the logger measures its overhead, the time spent in the original methods is measured as well.
+// Field calls are also timed if only MCSTEPLOG_FIELDTIMING is set. Both are asked from the logger on
+// every call since the field may already be called before the logger is initialized in ConstructGeometry.
+
+#define INTERCEPT_STEPPING(APP, LIB, SYMBOL)                                                \
+  void APP::Stepping()                                                                      \
+  {                                                                                         \
+    static const StepMethodType origMethod = getOriginalMethod<StepMethodType>(LIB, SYMBOL); \
+    auto baseptr = reinterpret_cast<TVirtualMCApplication*>(this);                          \
+    performLogging(baseptr);                                                                \
+    if (!isLoggerInstrumented()) {                                                          \
+      (baseptr->*origMethod)();                                                             \
+      return;                                                                               \
+    }                                                                                       \
+    auto start = o2::readCycles();                                                          \
+    (baseptr->*origMethod)();                                                               \
+    addOriginalSteppingCycles(o2::readCycles() - start);                                    \
   }
 
-#define INTERCEPT_FINISHEVENT(APP, LIB, SYMBOL)                    \
-  void APP::FinishEvent()                                          \
-  {                                                                \
-    auto baseptr = reinterpret_cast<TVirtualMCApplication*>(this); \
-    flushLog();                                                    \
-    dispatchOriginal(baseptr, LIB, SYMBOL);                        \
+#define INTERCEPT_FINISHEVENT(APP, LIB, SYMBOL)                                             \
+  void APP::FinishEvent()                                                                   \
+  {                                                                                         \
+    static const StepMethodType origMethod = getOriginalMethod<StepMethodType>(LIB, SYMBOL); \
+    auto baseptr = reinterpret_cast<TVirtualMCApplication*>(this);                          \
+    flushLog();                                                                             \
+    (baseptr->*origMethod)();                                                               \
+  }
+
+// the track hooks record one entry per track
+#define INTERCEPT_PRETRACK(APP, LIB, SYMBOL)                                                \
+  void APP::PreTrack()                                                                      \
+  {                                                                                         \
+    static const StepMethodType origMethod = getOriginalMethod<StepMethodType>(LIB, SYMBOL); \
+    auto baseptr = reinterpret_cast<TVirtualMCApplication*>(this);                          \
+    beginTrack();                                                                           \
+    (baseptr->*origMethod)();                                                               \
+  }
+
+#define INTERCEPT_POSTTRACK(APP, LIB, SYMBOL)                                               \
+  void APP::PostTrack()                                                                     \
+  {                                                                                         \
+    static const StepMethodType origMethod = getOriginalMethod<StepMethodType>(LIB, SYMBOL); \
+    auto baseptr = reinterpret_cast<TVirtualMCApplication*>(this);                          \
+    endTrack();                                                                             \
+    (baseptr->*origMethod)();                                                               \
   }
 
 // we use the ConstructGeometry hook to setup the logger
-#define INTERCEPT_GEOMETRYINIT(APP, LIB, SYMBOL)                   \
-  void APP::ConstructGeometry()                                    \
-  {                                                                \
-    auto baseptr = reinterpret_cast<TVirtualMCApplication*>(this); \
-    dispatchOriginal(baseptr, LIB, SYMBOL);                        \
-    initLogger();                                                  \
+#define INTERCEPT_GEOMETRYINIT(APP, LIB, SYMBOL)                                            \
+  void APP::ConstructGeometry()                                                             \
+  {                                                                                         \
+    static const StepMethodType origMethod = getOriginalMethod<StepMethodType>(LIB, SYMBOL); \
+    auto baseptr = reinterpret_cast<TVirtualMCApplication*>(this);                          \
+    (baseptr->*origMethod)();                                                               \
+    initLogger();                                                                           \
   }
 
 // the runtime will now dispatch to these functions due to LD_PRELOAD
@@ -89,12 +150,25 @@ INTERCEPT_FINISHEVENT(AliMC, "libSTEER", "_ZN5AliMC11FinishEventEv")
 INTERCEPT_GEOMETRYINIT(FairMCApplication, "libBase", "_ZN17FairMCApplication17ConstructGeometryEv")
 INTERCEPT_GEOMETRYINIT(AliMC, "libSTEER", "_ZN5AliMC17ConstructGeometryEv")
 
-#define INTERCEPT_FIELD(FIELD, LIB, SYMBOL)                     \
-  void FIELD::Field(const double* point, double* bField)        \
-  {                                                             \
-    auto baseptr = reinterpret_cast<TVirtualMagField*>(this);   \
-    dispatchOriginalField(baseptr, LIB, SYMBOL, point, bField); \
-    logField(point, bField);                                    \
+INTERCEPT_PRETRACK(FairMCApplication, "libBase", "_ZN17FairMCApplication8PreTrackEv")
+INTERCEPT_PRETRACK(AliMC, "libSTEER", "_ZN5AliMC8PreTrackEv")
+
+INTERCEPT_POSTTRACK(FairMCApplication, "libBase", "_ZN17FairMCApplication9PostTrackEv")
+INTERCEPT_POSTTRACK(AliMC, "libSTEER", "_ZN5AliMC9PostTrackEv")
+
+#define INTERCEPT_FIELD(FIELD, LIB, SYMBOL)                                                   \
+  void FIELD::Field(const double* point, double* bField)                                      \
+  {                                                                                           \
+    static const FieldMethodType origMethod = getOriginalMethod<FieldMethodType>(LIB, SYMBOL); \
+    auto baseptr = reinterpret_cast<TVirtualMagField*>(this);                                 \
+    if (!isFieldTimed()) {                                                                    \
+      (baseptr->*origMethod)(point, bField);                                                  \
+      logField(point, bField, 0);                                                             \
+      return;                                                                                 \
+    }                                                                                         \
+    auto start = o2::readCycles();                                                            \
+    (baseptr->*origMethod)(point, bField);                                                    \
+    logField(point, bField, o2::readCycles() - start);                                        \
   }
 
 namespace o2
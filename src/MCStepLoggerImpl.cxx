@@ -15,9 +15,18 @@
 
 #include "MCStepLogger/StepInfo.h"
 #include "MCStepLogger/MetaInfo.h"
+#include "MCStepLogger/BinaryStepFormat.h"
+#include "MCStepLogger/SharedMemoryStream.h"
+#include "MCStepLogger/MCAnalysisManager.h"
+#include "MCStepLogger/BasicMCAnalysis.h"
+#include "MCStepLogger/TimingMCAnalysis.h"
+#include "MCStepLogger/CycleClock.h"
+#include "MCStepLogger/TreeWriteSettings.h"
+#include "MCStepLogger/StepLoggerIndex.h"
 #include <TBranch.h>
 #include <TClonesArray.h>
 #include <TFile.h>
+#include <TROOT.h>
 #include <TGeoManager.h>
 #include <TGeoVolume.h>
 #include <TTree.h>
@@ -27,12 +36,24 @@
 #include <sstream>
 
 #include <dlfcn.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
 #include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <fstream>
 #include <iostream>
+#include <limits>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <set>
 #include <sstream>
+#include <thread>
 #ifdef NDEBUG
 #undef NDEBUG
 #endif
@@ -40,13 +61,124 @@
 
 namespace o2
 {
+// steps are written in the compact binary format instead of a TTree
+bool isBinaryOutput()
+{
+  const char* f = std::getenv("MCSTEPLOG_OUTPUT");
+  return f && std::strcmp(f, "binary") == 0;
+}
+
+// events are published to a shared memory stream instead of a file
+bool isStreamOutput()
+{
+  const char* f = std::getenv("MCSTEPLOG_OUTPUT");
+  return f && std::strcmp(f, "shm") == 0;
+}
+
+// the analyses run inside the simulation, only their results are written
+bool isOnlineOutput()
+{
+  const char* f = std::getenv("MCSTEPLOG_OUTPUT");
+  return f && std::strcmp(f, "online") == 0;
+}
+
+// the time between consecutive steps is measured and attributed to the steps
+bool isTiming()
+{
+  return std::getenv("MCSTEPLOG_TIMING") != nullptr;
+}
+
+// the time spent in the original Field() is measured and aggregated
+bool isFieldTiming()
+{
+  return std::getenv("MCSTEPLOG_FIELDTIMING") != nullptr;
+}
+
+// memory (in bytes) the logger may use for the containers of one event before it
+// flushes them as a chunk, 0 if unlimited
+std::size_t getMemoryBudget()
+{
+  if (const char* n = std::getenv("MCSTEPLOG_MAXMEMORY")) {
+    // given in MB
+    auto mb = std::atoi(n);
+    if (mb > 0) {
+      return static_cast<std::size_t>(mb) << 20;
+    }
+  }
+  return 0;
+}
+
+// number of entries of the simulated field cache, 0 if disabled
+int getFieldCacheSize()
+{
+  if (const char* n = std::getenv("MCSTEPLOG_FIELDCACHE")) {
+    auto size = std::atoi(n);
+    // a plain switch without size gets a reasonable default
+    return size > 0 ? size : 64;
+  }
+  return 0;
+}
+
+// tolerance (in cm) below which field queries are considered to be the same point, 0 means bitwise equal
+double getFieldCacheTolerance()
+{
+  if (const char* t = std::getenv("MCSTEPLOG_FIELDCACHE_TOLERANCE")) {
+    return std::max(0., std::atof(t));
+  }
+  return 0.;
+}
+
+// the logger measures its own overhead
+bool isInstrumented()
+{
+  return std::getenv("MCSTEPLOG_STATS") != nullptr;
+}
+
+// steps are collected per event and written to a file (TTree or binary), to a
+// stream or analysed online instead of only printing a summary
+bool isFileOutput()
+{
+  return std::getenv("MCSTEPLOG_TTREE") || isBinaryOutput() || isStreamOutput() || isOnlineOutput();
+}
+
+// a TTree is written unless another output is chosen
+bool isTreeOutput()
+{
+  return isFileOutput() && !isBinaryOutput() && !isStreamOutput() && !isOnlineOutput();
+}
+
+// field calls are aggregated per step, only supported for the tree output
+bool isAggregatedCalls()
+{
+  return std::getenv("MCSTEPLOG_AGGREGATECALLS") && isTreeOutput();
+}
+
 const char* getLogFileName()
 {
   if (const char* f = std::getenv("MCSTEPLOG_OUTFILE")) {
     return f;
   } else {
-    return "MCStepLoggerOutput.root";
+    return isBinaryOutput() ? "MCStepLoggerOutput.bin" : "MCStepLoggerOutput.root";
+  }
+}
+
+// each worker thread writes its own file instead of all workers sharing one
+bool isPerThreadOutput()
+{
+  // there is only one stream or analysis, it is shared by all workers
+  return std::getenv("MCSTEPLOG_PERTHREAD") != nullptr && !isStreamOutput() && !isOnlineOutput();
+}
+
+// the worker id is inserted before the extension, e.g. MCStepLoggerOutput_w3.root
+std::string getWorkerLogFileName(int workerid)
+{
+  std::string name = getLogFileName();
+  auto dot = name.find_last_of('.');
+  auto slash = name.find_last_of('/');
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+    dot = name.size();
   }
+  return name.substr(0, dot) + "_w" + std::to_string(workerid) + name.substr(dot);
 }
 
 const char* getVolMapFile()
@@ -60,7 +192,7 @@ const char* getVolMapFile()
 
 // initializes a mapping from volumename to detector
 // used for step resolution to detectors
-void initVolumeMap()
+void readVolumeMap()
 {
   auto volmap = new std::map<std::string, std::string>;
   // open for reading or fail
@@ -82,110 +214,1153 @@ void initVolumeMap()
           counter++;
         }
       }
-      // put into map
-      volmap->insert({ keyvalue[0], keyvalue[1] });
+      // put into map
+      volmap->insert({ keyvalue[0], keyvalue[1] });
+    }
+    ifs.close();
+    StepInfo::volnametomodulemap = volmap;
+  } else {
+    std::cerr << "[MCLOGGER:] VOLUMEMAPSFILE NOT FILE\n";
+    StepInfo::volnametomodulemap = nullptr;
+  }
+}
+
+void initVolumeMap()
+{
+  // shared by the loggers of all threads, read only once
+  static std::once_flag once;
+  std::call_once(once, readVolumeMap);
+}
+
+// accepts or rejects steps before anything is logged
+// configured by a file given via MCSTEPLOG_FILTERFILE with one criterion per line
+//   volume <name>                   accept steps in this volume
+//   module <name>                   accept steps in volumes mapped to this module via the volume map
+//   pdg <code>                      accept steps of particles with this PDG code
+//   ekin <min> <max>                accept steps with kinetic energy in this range (GeV)
+//   rz <rmin> <rmax> <zmin> <zmax>  accept steps inside this box in the r-z plane (cm)
+// Several volumes/modules or PDG codes are combined with OR, different criteria with AND.
+// Only the criteria present require the corresponding queries to TVirtualMC.
+class StepFilter
+{
+  enum EDecision : char { kUnknown = 0,
+                          kAccept,
+                          kReject };
+
+  bool mEnabled = false;
+  std::set<std::string> mVolumes;
+  std::set<std::string> mModules;
+  std::vector<int> mPDGs;
+  bool mHasEkin = false;
+  double mEkinMin = 0.;
+  double mEkinMax = 0.;
+  bool mHasRZ = false;
+  double mRMin2 = 0.;
+  double mRMax2 = 0.;
+  double mZMin = 0.;
+  double mZMax = 0.;
+  // cached decision per volume id
+  std::vector<EDecision> mVolumeDecisions;
+
+  EDecision decideVolume(TVirtualMC* mc) const
+  {
+    std::string volname(mc->CurrentVolName());
+    if (mVolumes.count(volname)) {
+      return kAccept;
+    }
+    if (!mModules.empty() && StepInfo::volnametomodulemap) {
+      auto iter = StepInfo::volnametomodulemap->find(volname);
+      if (iter != StepInfo::volnametomodulemap->end() && mModules.count(iter->second)) {
+        return kAccept;
+      }
+    }
+    return kReject;
+  }
+
+ public:
+  StepFilter()
+  {
+    const char* f = std::getenv("MCSTEPLOG_FILTERFILE");
+    if (!f) {
+      return;
+    }
+    std::cerr << "[MCLOGGER:] TRYING TO READ STEP FILTERS FROM " << f << "\n";
+    std::ifstream ifs(f);
+    if (!ifs.is_open()) {
+      std::cerr << "[MCLOGGER:] STEP FILTER FILE NOT FOUND\n";
+      return;
+    }
+    std::string line;
+    while (std::getline(ifs, line)) {
+      std::istringstream ss(line);
+      std::string key;
+      if (!(ss >> key) || key[0] == '#') {
+        continue;
+      }
+      if (key == "volume") {
+        std::string name;
+        while (ss >> name) {
+          mVolumes.insert(name);
+        }
+      } else if (key == "module") {
+        std::string name;
+        while (ss >> name) {
+          mModules.insert(name);
+        }
+      } else if (key == "pdg") {
+        int pdg;
+        while (ss >> pdg) {
+          mPDGs.push_back(pdg);
+        }
+      } else if (key == "ekin" && (ss >> mEkinMin >> mEkinMax)) {
+        mHasEkin = true;
+      } else if (key == "rz") {
+        double rmin, rmax;
+        if (ss >> rmin >> rmax >> mZMin >> mZMax) {
+          mRMin2 = rmin * rmin;
+          mRMax2 = rmax * rmax;
+          mHasRZ = true;
+        }
+      } else {
+        std::cerr << "[MCLOGGER:] IGNORING STEP FILTER LINE " << line << "\n";
+      }
+    }
+    mEnabled = !mVolumes.empty() || !mModules.empty() || !mPDGs.empty() || mHasEkin || mHasRZ;
+  }
+
+  bool isEnabled() const { return mEnabled; }
+
+  bool accept(TVirtualMC* mc)
+  {
+    if (!mEnabled) {
+      return true;
+    }
+    if (!mVolumes.empty() || !mModules.empty()) {
+      int copyNo;
+      auto id = mc->CurrentVolID(copyNo);
+      if (id < 0) {
+        return false;
+      }
+      if (id >= mVolumeDecisions.size()) {
+        mVolumeDecisions.resize(id + 1, kUnknown);
+      }
+      auto& decision = mVolumeDecisions[id];
+      if (decision == kUnknown) {
+        decision = decideVolume(mc);
+      }
+      if (decision == kReject) {
+        return false;
+      }
+    }
+    if (!mPDGs.empty() && std::find(mPDGs.begin(), mPDGs.end(), mc->TrackPid()) == mPDGs.end()) {
+      return false;
+    }
+    if (mHasEkin) {
+      auto ekin = mc->Etot() - mc->TrackMass();
+      if (ekin < mEkinMin || ekin > mEkinMax) {
+        return false;
+      }
+    }
+    if (mHasRZ) {
+      double x, y, z;
+      mc->TrackPosition(x, y, z);
+      auto r2 = x * x + y * y;
+      if (r2 < mRMin2 || r2 > mRMax2 || z < mZMin || z > mZMax) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+// number of events after which the output tree is flushed and saved to disk,
+// which is at most what is lost in case of a crash
+int getAutoSaveEvents()
+{
+  if (const char* n = std::getenv("MCSTEPLOG_AUTOSAVE")) {
+    return std::atoi(n);
+  }
+  return 10;
+}
+
+// compression, basket size and split level of the tree output
+TreeWriteSettings getTreeWriteSettings()
+{
+  TreeWriteSettings settings;
+  if (const char* c = std::getenv("MCSTEPLOG_COMPRESSION")) {
+    if (!settings.setCompression(c)) {
+      std::cerr << "[MCLOGGER:] UNKNOWN COMPRESSION " << c << ", USING THE DEFAULT OF ROOT\n";
+    }
+  }
+  if (const char* n = std::getenv("MCSTEPLOG_BASKETSIZE")) {
+    auto size = std::atoi(n);
+    if (size > 0) {
+      settings.basketsize = size;
+    }
+  }
+  if (const char* n = std::getenv("MCSTEPLOG_SPLITLEVEL")) {
+    settings.splitlevel = std::atoi(n);
+  }
+  return settings;
+}
+
+// the containers of one event handed to an output
+struct EventData {
+  EventHeader* header = nullptr;
+  std::vector<StepInfo>* steps = nullptr;
+  std::vector<MagCallInfo>* calls = nullptr;
+  StepLookups* lookups = nullptr;
+  // only if the field calls are aggregated per step, stored instead of the calls
+  std::vector<MagCallSummary>* callsummaries = nullptr;
+  // one record per finished track, empty if the track hooks are not intercepted
+  std::vector<TrackInfo>* tracks = nullptr;
+  // only if the logger measures itself
+  LoggerStats* stats = nullptr;
+  // only if the field calls are timed
+  FieldStats* fieldstats = nullptr;
+  // seconds since the previous event or chunk of the same worker was written
+  float walltime = 0.;
+};
+
+// interface of the output backends, events are written one by one
+class LoggerOutput
+{
+ public:
+  virtual ~LoggerOutput() = default;
+  virtual void fill(EventData const& data) = 0;
+  virtual void close() = 0;
+};
+
+// keeps the output file and tree open for the whole run so that all branches
+// are filled together once per event
+// volume names are written once per file as RunLookups, the Lookups of an event
+// only carry the tracks and the names not written before
+class TTreeOutput : public LoggerOutput
+{
+  TFile* mFile = nullptr;
+  TTree* mTree = nullptr;
+  // addresses the branches are connected to
+  EventData mData;
+  // all names written so far
+  StepLookups mRunLookups;
+  StepLookups mEventLookups;
+  // sizes of all entries, to select events without reading the tree
+  StepLoggerIndex mIndex;
+
+  // names are interned, hence a different pointer means a different name
+  static void splitNames(std::vector<std::string*> const& names, std::vector<std::string*>& run,
+                         std::vector<std::string*>& event)
+  {
+    event.clear();
+    for (std::size_t i = 0; i < names.size(); ++i) {
+      if (names[i] && (i >= run.size() || names[i] != run[i])) {
+        if (i >= run.size()) {
+          run.resize(i + 1, nullptr);
+        }
+        run[i] = names[i];
+        event.resize(i + 1, nullptr);
+        event[i] = names[i];
+      }
+    }
+  }
+
+  void writeRunLookups()
+  {
+    TDirectory::TContext context(mFile);
+    mFile->WriteObject(&mRunLookups, "RunLookups", "Overwrite");
+  }
+
+ public:
+  // branches are created for all containers present in data
+  void open(const std::string& filename, EventData const& data)
+  {
+    // do not leave the file as current directory behind for the application
+    TDirectory::TContext context;
+    mFile = new TFile(filename.c_str(), "RECREATE");
+    auto settings = getTreeWriteSettings();
+    settings.apply(mFile);
+    // names, media, materials and modules of all volumes, complemented when the file is closed
+    if (StepInfo::usegeometrylookups) {
+      mRunLookups = StepInfo::geometrylookups;
+    }
+    writeRunLookups();
+    mTree = new TTree("StepLoggerTree", "Tree container information from MC step logger");
+    mData = data;
+    mData.lookups = &mEventLookups;
+    mTree->Branch("Header", &mData.header);
+    settings.branch(mTree, "Steps", &mData.steps);
+    if (mData.callsummaries) {
+      settings.branch(mTree, "CallSummaries", &mData.callsummaries);
+    } else {
+      settings.branch(mTree, "Calls", &mData.calls);
+    }
+    settings.branch(mTree, "Lookups", &mData.lookups);
+    if (mData.tracks) {
+      settings.branch(mTree, "Tracks", &mData.tracks);
+    }
+    if (mData.stats) {
+      mTree->Branch("LoggerStats", &mData.stats);
+    }
+    if (mData.fieldstats) {
+      mTree->Branch("FieldStats", &mData.fieldstats);
+    }
+    auto autosave = getAutoSaveEvents();
+    if (autosave > 0) {
+      // positive values are interpreted as number of entries
+      mTree->SetAutoFlush(autosave);
+      mTree->SetAutoSave(autosave);
+    }
+  }
+
+  // fill one event, branch addresses are updated in case other containers are passed
+  void fill(EventData const& data) override
+  {
+    mData = data;
+    splitNames(data.lookups->volidtovolname, mRunLookups.volidtovolname, mEventLookups.volidtovolname);
+    splitNames(data.lookups->volidtomodule, mRunLookups.volidtomodule, mEventLookups.volidtomodule);
+    splitNames(data.lookups->volidtomedium, mRunLookups.volidtomedium, mEventLookups.volidtomedium);
+    splitNames(data.lookups->volidtomaterial, mRunLookups.volidtomaterial, mEventLookups.volidtomaterial);
+    mEventLookups.tracktopdg = data.lookups->tracktopdg;
+    mEventLookups.tracktoparent = data.lookups->tracktoparent;
+    mData.lookups = &mEventLookups;
+    auto bytes = mTree->Fill();
+    addIndexEntry(data, bytes);
+  }
+
+  void addIndexEntry(EventData const& data, long bytes)
+  {
+    EventIndexEntry e;
+    e.entry = mTree->GetEntries() - 1;
+    e.eventid = data.header->eventid;
+    e.workerid = data.header->workerid;
+    e.chunk = data.header->chunk;
+    e.lastchunk = data.header->lastchunk;
+    e.nsteps = data.steps->size();
+    if (data.callsummaries) {
+      for (auto& summary : *data.callsummaries) {
+        e.ncalls += summary.ncalls;
+      }
+    } else {
+      e.ncalls = data.calls->size();
+    }
+    // without track records, the tracks are known from the lookups of their steps
+    if (data.tracks && !data.tracks->empty()) {
+      e.ntracks = data.tracks->size();
+      e.nprimaries = std::count_if(data.tracks->begin(), data.tracks->end(), [](TrackInfo const& t) { return t.parent < 0; });
+    } else {
+      auto& lookups = *data.lookups;
+      for (std::size_t i = 0; i < lookups.tracktopdg.size(); ++i) {
+        if (lookups.tracktopdg[i] != 0) {
+          e.ntracks++;
+          e.nprimaries += i < lookups.tracktoparent.size() && lookups.tracktoparent[i] < 0;
+        }
+      }
+    }
+    e.bytes = bytes;
+    e.walltime = data.walltime;
+    mIndex.entries.push_back(e);
+  }
+
+  void close() override
+  {
+    if (!mFile) {
+      return;
+    }
+    TDirectory::TContext context(mFile);
+    mTree->Write("", TObject::kOverwrite);
+    writeRunLookups();
+    mFile->WriteObject(&mIndex, "StepLoggerIndex", "Overwrite");
+    mFile->Close();
+    // the tree is owned and deleted by the file
+    delete mFile;
+    mFile = nullptr;
+    mTree = nullptr;
+  }
+};
+
+// writes events in the compact binary format (see BinaryStepFormat.h)
+class BinaryOutput : public LoggerOutput
+{
+  BinaryStepWriter mWriter;
+
+ public:
+  void open(const std::string& filename)
+  {
+    // energies can be stored with half precision to save space, the chunks are compressed
+    // as given by MCSTEPLOG_COMPRESSION like the tree output
+    mWriter.open(filename, std::getenv("MCSTEPLOG_FLOAT16") != nullptr, getTreeWriteSettings().compression);
+    // names, media, materials and modules of all volumes, events only carry the others
+    if (StepInfo::usegeometrylookups) {
+      mWriter.writeLookups(StepInfo::geometrylookups);
+    }
+  }
+
+  // the logger statistics are only printed but not part of the binary format
+  void fill(EventData const& data) override
+  {
+    mWriter.writeEvent(*data.header, *data.steps, *data.calls, *data.lookups, data.tracks);
+  }
+
+  void close() override { mWriter.close(); }
+};
+
+// publishes events to a shared memory ring buffer (see SharedMemoryStream.h)
+class StreamOutput : public LoggerOutput
+{
+  SharedMemoryStreamWriter mWriter;
+
+ public:
+  void open()
+  {
+    std::string name = "/MCStepLogger";
+    if (const char* n = std::getenv("MCSTEPLOG_SHM_NAME")) {
+      name = n;
+    }
+    // size of the ring in MB
+    std::size_t size = 256;
+    if (const char* n = std::getenv("MCSTEPLOG_SHM_SIZE")) {
+      if (std::atoi(n) > 0) {
+        size = std::atoi(n);
+      }
+    }
+    // by default the transport waits for the consumer if the ring is full
+    bool drop = std::getenv("MCSTEPLOG_SHM_DROP") != nullptr;
+    if (StepInfo::usegeometrylookups) {
+      mWriter.setLookups(&StepInfo::geometrylookups);
+    }
+    if (mWriter.create(name, size << 20, drop, std::getenv("MCSTEPLOG_FLOAT16") != nullptr)) {
+      std::cerr << "[MCLOGGER:] STREAMING TO SHARED MEMORY " << name << " OF " << size << " MB"
+                << (drop ? ", DROPPING EVENTS IF FULL" : "") << "\n";
+    }
+  }
+
+  // the logger statistics are only printed but not part of the stream
+  void fill(EventData const& data) override
+  {
+    mWriter.writeEvent(*data.header, *data.steps, *data.calls, *data.lookups, data.tracks);
+  }
+
+  void close() override
+  {
+    std::cerr << "[MCLOGGER:] " << mWriter.nDropped() << " EVENTS NOT STREAMED\n";
+    mWriter.close();
+  }
+};
+
+// runs the analyses of mcStepAnalysis on each event inside the simulation
+class OnlineOutput : public LoggerOutput
+{
+  std::string mDirectory = "MCStepLoggerAnalysis";
+
+ public:
+  void open()
+  {
+    if (const char* d = std::getenv("MCSTEPLOG_ONLINE_DIR")) {
+      mDirectory = d;
+    }
+    auto& anamgr = mcstepanalysis::MCAnalysisManager::Instance();
+    // analyses registered by the application before come on top
+    new mcstepanalysis::BasicMCAnalysis();
+    new mcstepanalysis::TimingMCAnalysis();
+    // the events only carry the names of volumes unknown to the geometry
+    if (StepInfo::usegeometrylookups) {
+      anamgr.setRunLookups(StepInfo::geometrylookups);
+    }
+    const char* label = std::getenv("MCSTEPLOG_ONLINE_LABEL");
+    anamgr.setLabel(label ? label : "online");
+    if (anamgr.startOnline()) {
+      std::cerr << "[MCLOGGER:] ANALYSING ONLINE, RESULTS GO TO " << mDirectory << "\n";
+    }
+  }
+
+  void fill(EventData const& data) override
+  {
+    mcstepanalysis::MCAnalysisManager::Instance().analyzeOnline(data.steps, data.calls, data.lookups, data.header, data.tracks);
+  }
+
+  void close() override { mcstepanalysis::MCAnalysisManager::Instance().finishOnline(mDirectory); }
+};
+
+// maximum number of events waiting to be written by the asynchronous writer
+int getAsyncQueueDepth()
+{
+  if (const char* n = std::getenv("MCSTEPLOG_ASYNC_DEPTH")) {
+    auto depth = std::atoi(n);
+    if (depth > 0) {
+      return depth;
+    }
+  }
+  return 2;
+}
+
+// per-event data handed over from the simulation thread to the writer thread
+struct EventBuffer {
+  EventHeader header;
+  std::vector<StepInfo> steps;
+  std::vector<MagCallInfo> calls;
+  std::vector<MagCallSummary> callsummaries;
+  std::vector<TrackInfo> tracks;
+  StepLookups lookups;
+  LoggerStats stats;
+  FieldStats fieldstats;
+  float walltime = 0.;
+  // the secondary processes the steps point to
+  SecondaryProcessArena arena;
+  bool hasCallSummaries = false;
+  bool hasTracks = false;
+  bool hasStats = false;
+  bool hasFieldStats = false;
+
+  void clear()
+  {
+    // keep the capacities, buffers are recycled
+    steps.clear();
+    calls.clear();
+    callsummaries.clear();
+    tracks.clear();
+    arena.reset();
+    lookups.tracktopdg.clear();
+    lookups.tracktoparent.clear();
+  }
+};
+
+// does the ROOT serialization of events in a background thread
+// the simulation thread only swaps its per-event containers into a bounded queue
+// and continues with transporting the next event
+class AsyncWriter
+{
+  LoggerOutput& mOutput;
+  std::size_t mMaxDepth;
+  // events waiting to be written
+  std::deque<EventBuffer*> mQueue;
+  // already written buffers ready to be reused
+  std::vector<EventBuffer*> mFree;
+  std::mutex mMutex;
+  std::condition_variable mCondition;
+  std::thread mThread;
+  bool mStop = false;
+  // time the simulation thread had to wait for a free slot
+  std::chrono::nanoseconds mStallTime{ 0 };
+
+  void run()
+  {
+    while (true) {
+      EventBuffer* buffer = nullptr;
+      {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mCondition.wait(lock, [this] { return mStop || !mQueue.empty(); });
+        if (mQueue.empty()) {
+          // stopped and everything written
+          return;
+        }
+        buffer = mQueue.front();
+        mQueue.pop_front();
+      }
+      EventData data{ &buffer->header, &buffer->steps, &buffer->calls, &buffer->lookups };
+      if (buffer->hasCallSummaries) {
+        data.callsummaries = &buffer->callsummaries;
+      }
+      if (buffer->hasTracks) {
+        data.tracks = &buffer->tracks;
+      }
+      if (buffer->hasStats) {
+        data.stats = &buffer->stats;
+      }
+      if (buffer->hasFieldStats) {
+        data.fieldstats = &buffer->fieldstats;
+      }
+      data.walltime = buffer->walltime;
+      mOutput.fill(data);
+      buffer->clear();
+      {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mFree.push_back(buffer);
+      }
+      mCondition.notify_all();
+    }
+  }
+
+ public:
+  AsyncWriter(LoggerOutput& output, int depth) : mOutput(output), mMaxDepth(depth)
+  {
+    mThread = std::thread(&AsyncWriter::run, this);
+  }
+
+  ~AsyncWriter()
+  {
+    stop();
+    for (auto b : mFree) {
+      delete b;
+    }
+  }
+
+  // hand over the containers of the current event, they are left empty
+  // may be called by several worker threads, each with its own containers
+  void push(EventData const& data, SecondaryProcessArena& arena)
+  {
+    EventBuffer* buffer = nullptr;
+    {
+      auto start = std::chrono::steady_clock::now();
+      std::unique_lock<std::mutex> lock(mMutex);
+      mCondition.wait(lock, [this] { return mQueue.size() < mMaxDepth; });
+      // only reported in total when the writer stops
+      mStallTime += std::chrono::steady_clock::now() - start;
+      if (mFree.empty()) {
+        buffer = new EventBuffer;
+      } else {
+        buffer = mFree.back();
+        mFree.pop_back();
+      }
+    }
+    buffer->header = *data.header;
+    buffer->walltime = data.walltime;
+    buffer->steps.swap(*data.steps);
+    buffer->calls.swap(*data.calls);
+    buffer->hasCallSummaries = data.callsummaries != nullptr;
+    if (data.callsummaries) {
+      buffer->callsummaries.swap(*data.callsummaries);
+    }
+    buffer->hasTracks = data.tracks != nullptr;
+    if (data.tracks) {
+      buffer->tracks.swap(*data.tracks);
+    }
+    buffer->arena.swap(arena);
+    // track information is per event while the volume lookups are shared by all events
+    auto& lookups = *data.lookups;
+    buffer->lookups.tracktopdg.swap(lookups.tracktopdg);
+    buffer->lookups.tracktoparent.swap(lookups.tracktoparent);
+    buffer->lookups.volidtovolname = lookups.volidtovolname;
+    buffer->lookups.volidtomodule = lookups.volidtomodule;
+    buffer->lookups.volidtomedium = lookups.volidtomedium;
+    buffer->lookups.volidtomaterial = lookups.volidtomaterial;
+    buffer->hasStats = data.stats != nullptr;
+    if (data.stats) {
+      buffer->stats = *data.stats;
+    }
+    buffer->hasFieldStats = data.fieldstats != nullptr;
+    if (data.fieldstats) {
+      buffer->fieldstats = *data.fieldstats;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mQueue.push_back(buffer);
+    }
+    mCondition.notify_all();
+  }
+
+  // write all pending events and join the writer thread
+  void stop()
+  {
+    if (!mThread.joinable()) {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mStop = true;
+    }
+    mCondition.notify_all();
+    mThread.join();
+    std::cerr << "[MCLOGGER:] WAITED " << std::chrono::duration<double, std::milli>(mStallTime).count()
+              << " ms IN TOTAL FOR ASYNC WRITER\n";
+  }
+};
+
+// running estimate of the number of entries per event used to pre-size containers
+struct ContainerSizeEstimate {
+  double mean = 0.;
+  void update(std::size_t n) { mean = (mean > 0.) ? 0.8 * mean + 0.2 * n : n; }
+  // leave some headroom to avoid growing in the middle of an event
+  std::size_t get() const { return static_cast<std::size_t>(1.2 * mean); }
+};
+
+// open addressing hash set of integers, used to count distinct values
+// without allocating in the steady state
+class FlatIntSet
+{
+  static constexpr int EMPTY = std::numeric_limits<int>::min();
+  std::vector<int> mSlots;
+  std::size_t mSize = 0;
+
+  std::size_t slot(int key, std::size_t mask) const
+  {
+    auto h = static_cast<unsigned int>(key) * 2654435761u;
+    return (h ^ (h >> 16)) & mask;
+  }
+
+  void rehash(std::size_t capacity)
+  {
+    std::vector<int> old(capacity, EMPTY);
+    old.swap(mSlots);
+    mSize = 0;
+    for (auto key : old) {
+      if (key != EMPTY) {
+        insert(key);
+      }
+    }
+  }
+
+ public:
+  FlatIntSet() : mSlots(64, EMPTY) {}
+
+  void insert(int key)
+  {
+    // keep the load factor below 0.5
+    if (2 * (mSize + 1) > mSlots.size()) {
+      rehash(2 * mSlots.size());
+    }
+    auto mask = mSlots.size() - 1;
+    auto i = slot(key, mask);
+    while (mSlots[i] != EMPTY) {
+      if (mSlots[i] == key) {
+        return;
+      }
+      i = (i + 1) & mask;
+    }
+    mSlots[i] = key;
+    mSize++;
+  }
+
+  std::size_t size() const { return mSize; }
+
+  void clear()
+  {
+    std::fill(mSlots.begin(), mSlots.end(), EMPTY);
+    mSize = 0;
+  }
+};
+
+// grow a dense volId-indexed vector if needed
+template <typename T>
+void ensureIndex(std::vector<T>& v, int index, std::size_t stride = 1)
+{
+  if ((index + 1) * stride > v.size()) {
+    v.resize((index + 1) * stride);
+  }
+}
+
+// decides which steps are logged when only a fraction of them should be kept,
+// configured via MCSTEPLOG_SAMPLING (uniform, track or primary) and MCSTEPLOG_SAMPLING_N
+// keeping 1 in N steps, tracks or primaries, respectively
+class StepSampler
+{
+ public:
+  using EMode = SamplingMode;
+
+  StepSampler()
+  {
+    const char* mode = std::getenv("MCSTEPLOG_SAMPLING");
+    if (!mode) {
+      return;
+    }
+    if (const char* n = std::getenv("MCSTEPLOG_SAMPLING_N")) {
+      mN = std::atoi(n);
+    }
+    if (mN <= 1) {
+      std::cerr << "[MCLOGGER:] NO SAMPLING SINCE MCSTEPLOG_SAMPLING_N <= 1\n";
+      return;
+    }
+    std::string m(mode);
+    if (m == "uniform") {
+      mMode = EMode::kUniform;
+    } else if (m == "track") {
+      mMode = EMode::kTrack;
+    } else if (m == "primary") {
+      mMode = EMode::kPrimary;
+    } else {
+      std::cerr << "[MCLOGGER:] UNKNOWN SAMPLING MODE " << m << ", LOGGING ALL STEPS\n";
+      return;
+    }
+    std::cerr << "[MCLOGGER:] SAMPLING 1 IN " << mN << " (" << m << ")\n";
+  }
+
+  bool isEnabled() const { return mMode != EMode::kNone; }
+  EMode mode() const { return mMode; }
+  // the weight each logged record gets
+  float weight() const { return mMode == EMode::kNone ? 1. : mN; }
+
+  bool accept(TVirtualMC* mc)
+  {
+    switch (mMode) {
+      case EMode::kNone:
+        return true;
+      case EMode::kUniform:
+        return (mCounter++ % mN) == 0;
+      case EMode::kTrack:
+        return select(mc->GetStack()->GetCurrentTrackNumber());
+      case EMode::kPrimary:
+        return select(primaryOf(mc->GetStack()));
+    }
+    return true;
+  }
+
+  // to be called for every step, also those which are filtered out, such that the primary
+  // of a track is known even if none of the steps of its parent are logged
+  void followTrack(TVirtualMC* mc)
+  {
+    if (mMode == EMode::kPrimary) {
+      primaryOf(mc->GetStack());
+    }
+  }
+
+  // a different subset of tracks is chosen in each event
+  void nextEvent()
+  {
+    mEvent++;
+    mTrackToPrimary.clear();
+  }
+
+ private:
+  bool select(int id) const
+  {
+    // mix event and id to a pseudo-random but reproducible number
+    auto h = (static_cast<unsigned long long>(id) + 1) * 0x9E3779B97F4A7C15ull ^ mEvent * 0xC2B2AE3D27D4EB4Full;
+    h ^= h >> 31;
+    return (h % mN) == 0;
+  }
+
+  int primaryOf(TVirtualMCStack* stack)
+  {
+    auto track = stack->GetCurrentTrackNumber();
+    if (track < 0) {
+      return track;
+    }
+    if (track >= mTrackToPrimary.size()) {
+      mTrackToPrimary.resize(track + 1, -1);
+    }
+    auto& primary = mTrackToPrimary[track];
+    if (primary < 0) {
+      if (stack->GetCurrentTrack()->IsPrimary()) {
+        primary = track;
+      } else {
+        // parents have been transported before their secondaries
+        auto parent = stack->GetCurrentParentTrackNumber();
+        primary = (parent >= 0 && parent < mTrackToPrimary.size() && mTrackToPrimary[parent] >= 0) ? mTrackToPrimary[parent] : parent;
+      }
     }
-    ifs.close();
-    StepInfo::volnametomodulemap = volmap;
-  } else {
-    std::cerr << "[MCLOGGER:] VOLUMEMAPSFILE NOT FILE\n";
-    StepInfo::volnametomodulemap = nullptr;
+    return primary;
   }
-}
 
-template <typename T>
-void flushToTTree(const char* branchname, T* address)
+  EMode mMode = EMode::kNone;
+  int mN = 1;
+  unsigned long long mCounter = 0;
+  unsigned long long mEvent = 0;
+  std::vector<int> mTrackToPrimary;
+};
+
+// simulates an LRU cache of field values to see how often a query repeats a recent one;
+// points are quantized with the tolerance such that close-by queries share one entry
+class FieldCacheSimulator
 {
-  TFile* f = new TFile(getLogFileName(), "UPDATE");
-  const char* treename = "StepLoggerTree";
-  auto tree = (TTree*)f->Get(treename);
-  if (!tree) {
-    // create tree
-    tree = new TTree(treename, "Tree container information from MC step logger");
+  using Key = std::array<long long, 3>;
+  // most recently used first
+  std::vector<Key> mEntries;
+  int mCapacity = 0;
+  double mTolerance = 0.;
+
+  long long quantize(double v) const
+  {
+    if (mTolerance > 0.) {
+      return std::llround(v / mTolerance);
+    }
+    long long bits;
+    std::memcpy(&bits, &v, sizeof(bits));
+    return bits;
   }
-  auto branch = tree->GetBranch(branchname);
-  if (!branch) {
-    branch = tree->Branch(branchname, &address);
+
+ public:
+  FieldCacheSimulator(int capacity, double tolerance) : mCapacity(capacity), mTolerance(tolerance)
+  {
+    mEntries.reserve(capacity);
   }
-  branch->SetAddress(&address);
-  branch->Fill();
-  tree->SetEntries(branch->GetEntries());
-  // To avoid large number of cycles since whenever the file is opened and things are written, this is done as a new cycle
-  //f->Write();
-  tree->Write("", TObject::kOverwrite);
-  f->Close();
-  delete f;
-}
 
-void initTFile()
-{
-  if (!std::getenv("MCSTEPLOG_TTREE")) {
-    return;
+  int capacity() const { return mCapacity; }
+
+  // returns the LRU position of the point before the query or -1 if not found;
+  // the point becomes the most recent entry
+  int query(const double* x)
+  {
+    Key key{ quantize(x[0]), quantize(x[1]), quantize(x[2]) };
+    // caches are small, a linear search gives the LRU position for free
+    auto it = std::find(mEntries.begin(), mEntries.end(), key);
+    if (it != mEntries.end()) {
+      std::rotate(mEntries.begin(), it, it + 1);
+      return it - mEntries.begin();
+    }
+    if (mEntries.size() < mCapacity) {
+      mEntries.push_back(key);
+    } else {
+      mEntries.back() = key;
+    }
+    std::rotate(mEntries.begin(), mEntries.end() - 1, mEntries.end());
+    return -1;
   }
-  TFile* f = new TFile(getLogFileName(), "RECREATE");
-  f->Close();
-  delete f;
-}
+};
 
 // a class collecting field access per volume
 class FieldLogger
 {
   int counter = 0;
-  std::map<int, int> volumetosteps;
-  std::map<int, std::string> idtovolname;
+  // dense, indexed by volume id
+  std::vector<int> volumetosteps;
+  std::vector<std::string> idtovolname;
   bool mTTreeIO = false;
   std::vector<MagCallInfo> callcontainer;
+  // only the aggregates per step are kept in the aggregated mode
+  bool mAggregate = false;
+  std::vector<MagCallSummary> summarycontainer;
+  ContainerSizeEstimate mSizeEstimate;
+  // number of times the container had to grow during the current event
+  int mBufferGrowths = 0;
+  // time spent in the original Field() calls
+  bool mTiming = false;
+  double mSecondsPerCycle = 0.;
+  FieldStats mStats;
+  // step the last calls were attributed to, its weight and the number of calls
+  int mLastStep = -1;
+  float mLastWeight = 1.;
+  int mCallsInStep = 0;
+  // only if the field cache is simulated
+  std::unique_ptr<FieldCacheSimulator> mCache;
+
+  // online aggregation of calls and their time, weighted like the step they belong to
+  void aggregate(TVirtualMC* mc, const double* b, float calltime, float weight, int step)
+  {
+    int copyNo;
+    auto id = mc->CurrentVolID(copyNo);
+    if (id >= 0) {
+      ensureIndex(mStats.callspervolume, id);
+      ensureIndex(mStats.timepervolume, id);
+      mStats.callspervolume[id] += weight;
+      mStats.timepervolume[id] += weight * calltime;
+      ensureIndex(idtovolname, id);
+      if (idtovolname[id].empty()) {
+        idtovolname[id] = mc->CurrentVolName();
+      }
+    }
+    auto bucket = FieldStats::bucket(std::sqrt(b[0] * b[0] + b[1] * b[1] + b[2] * b[2]));
+    mStats.callsperbucket[bucket] += weight;
+    mStats.timeperbucket[bucket] += weight * calltime;
+    if (step != mLastStep) {
+      finishStep();
+      mLastStep = step;
+      mLastWeight = weight;
+    }
+    mCallsInStep++;
+  }
+
+  void printStats() const
+  {
+    for (int id = 0; id < mStats.callspervolume.size(); ++id) {
+      if (mStats.callspervolume[id] == 0) {
+        continue;
+      }
+      std::cerr << "[FIELDLOGGER]: VolName " << idtovolname[id] << " CALLS " << mStats.callspervolume[id] << " TIME "
+                << 1000. * mStats.timepervolume[id] << " ms\n";
+    }
+    for (int i = 0; i < FieldStats::NBUCKETS; ++i) {
+      if (i < FieldStats::NBUCKETS - 1) {
+        std::cerr << "[FIELDLOGGER]: |B| < " << FieldStats::bucketEdge(i);
+      } else {
+        std::cerr << "[FIELDLOGGER]: |B| >= " << FieldStats::bucketEdge(i - 1);
+      }
+      std::cerr << " CALLS " << mStats.callsperbucket[i] << " TIME " << 1000. * mStats.timeperbucket[i] << " ms\n";
+    }
+    for (int n = 1; n <= FieldStats::MAXCALLSPERSTEP; ++n) {
+      if (mStats.stepspercalls[n] > 0) {
+        std::cerr << "[FIELDLOGGER]: " << mStats.stepspercalls[n] << " STEPS WITH " << n
+                  << (n == FieldStats::MAXCALLSPERSTEP ? " OR MORE" : "") << " CALLS\n";
+      }
+    }
+  }
+
+  void printCacheStats() const
+  {
+    long queries = 0;
+    for (int id = 0; id < mStats.cachequeriespervolume.size(); ++id) {
+      auto n = mStats.cachequeriespervolume[id];
+      if (n == 0) {
+        continue;
+      }
+      queries += n;
+      auto repeats = mStats.cacherepeatspervolume[id];
+      std::cerr << "[FIELDLOGGER]: VolName " << idtovolname[id] << " QUERIES " << n << " REPEATED " << repeats << " ("
+                << 100. * repeats / n << " %)\n";
+    }
+    if (queries == 0) {
+      return;
+    }
+    // a cache with n entries hits all queries found at LRU positions below n
+    long hits = 0;
+    int nextsize = 1;
+    for (int depth = 0; depth < mCache->capacity(); ++depth) {
+      hits += mStats.cachehitsatdepth[depth];
+      if (depth + 1 == nextsize || depth + 1 == mCache->capacity()) {
+        std::cerr << "[FIELDLOGGER]: CACHE WITH " << depth + 1 << " ENTRIES HIT RATE " << 100. * hits / queries << " %\n";
+        nextsize *= 2;
+      }
+    }
+  }
 
  public:
   FieldLogger()
   {
     // check if streaming or interactive
     // configuration done via env variable
-    if (std::getenv("MCSTEPLOG_TTREE")) {
+    if (isFileOutput()) {
       mTTreeIO = true;
+      mAggregate = isAggregatedCalls();
+    }
+    if (isFieldTiming()) {
+      mTiming = true;
+      mSecondsPerCycle = 1. / cyclesPerSecond();
+    }
+    if (auto size = getFieldCacheSize()) {
+      mCache.reset(new FieldCacheSimulator(size, getFieldCacheTolerance()));
+      mStats.cachehitsatdepth.resize(size);
+    }
+    mStats.clear();
+  }
+
+  bool isCacheSimulated() const { return mCache != nullptr; }
+
+  // to be called for every field query such that the simulated cache sees the real sequence
+  void queryCache(TVirtualMC* mc, const double* x)
+  {
+    auto depth = mCache->query(x);
+    if (depth >= 0) {
+      mStats.cachehitsatdepth[depth]++;
+    }
+    int copyNo;
+    auto id = mc->CurrentVolID(copyNo);
+    if (id < 0) {
+      return;
+    }
+    ensureIndex(mStats.cachequeriespervolume, id);
+    ensureIndex(mStats.cacherepeatspervolume, id);
+    mStats.cachequeriespervolume[id]++;
+    mStats.cacherepeatspervolume[id] += depth >= 0;
+    ensureIndex(idtovolname, id);
+    if (idtovolname[id].empty()) {
+      idtovolname[id] = mc->CurrentVolName();
     }
   }
 
-  void addStep(TVirtualMC* mc, const double* x, const double* b)
+  // cycles is the time spent in the original Field() call if it was measured
+  void addStep(TVirtualMC* mc, const double* x, const double* b, float weight = 1., unsigned long long cycles = 0,
+               int step = -1)
   {
+    counter++;
+    float calltime = mTiming ? cycles * mSecondsPerCycle : 0.;
+    if (mTiming) {
+      aggregate(mc, b, calltime, weight, step);
+    }
+    if (mAggregate) {
+      MagCallInfo call(mc, x[0], x[1], x[2], b[0], b[1], b[2]);
+      call.weight = weight;
+      call.calltime = calltime;
+      if (summarycontainer.empty() || summarycontainer.back().stepid != call.stepid) {
+        if (summarycontainer.size() == summarycontainer.capacity()) {
+          mBufferGrowths++;
+        }
+        summarycontainer.emplace_back();
+      }
+      summarycontainer.back().add(call);
+      return;
+    }
     if (mTTreeIO) {
+      if (callcontainer.size() == callcontainer.capacity()) {
+        mBufferGrowths++;
+      }
       callcontainer.emplace_back(mc, x[0], x[1], x[2], b[0], b[1], b[2]);
+      callcontainer.back().weight = weight;
+      callcontainer.back().calltime = calltime;
       return;
     }
-    counter++;
     int copyNo;
     auto id = mc->CurrentVolID(copyNo);
-    if (volumetosteps.find(id) == volumetosteps.end()) {
-      volumetosteps.insert(std::pair<int, int>(id, 0));
-    } else {
-      volumetosteps[id]++;
+    if (id < 0) {
+      return;
     }
-    if (idtovolname.find(id) == idtovolname.end()) {
-      idtovolname.insert(std::pair<int, std::string>(id, std::string(mc->CurrentVolName())));
+    ensureIndex(volumetosteps, id);
+    volumetosteps[id]++;
+    ensureIndex(idtovolname, id);
+    if (idtovolname[id].empty()) {
+      idtovolname[id] = mc->CurrentVolName();
     }
   }
 
+  // count the calls of the last step, to be done before the aggregates are written
+  void finishStep()
+  {
+    if (mCallsInStep > 0) {
+      mStats.stepspercalls[std::min(mCallsInStep, FieldStats::MAXCALLSPERSTEP)] += mLastWeight;
+    }
+    mCallsInStep = 0;
+  }
+
+  std::vector<MagCallInfo>* getContainer() { return &callcontainer; }
+  std::vector<MagCallSummary>* getSummaries() { return mAggregate ? &summarycontainer : nullptr; }
+
+  // memory taken by the calls of the current chunk
+  std::size_t memoryUsage() const
+  {
+    return callcontainer.size() * sizeof(MagCallInfo) + summarycontainer.size() * sizeof(MagCallSummary);
+  }
+
+  // the calls were written as a chunk, the event continues
+  void clearChunk()
+  {
+    callcontainer.clear();
+    summarycontainer.clear();
+  }
+  // only filled if field calls are timed or the cache is simulated
+  FieldStats* getStats() { return (mTiming || mCache) ? &mStats : nullptr; }
+
   void clear()
   {
-    counter = 0;
-    volumetosteps.clear();
-    idtovolname.clear();
-    if (mTTreeIO) {
+    if (mAggregate) {
+      mSizeEstimate.update(summarycontainer.size());
+      summarycontainer.clear();
+      summarycontainer.reserve(mSizeEstimate.get());
+      mBufferGrowths = 0;
+    } else if (mTTreeIO) {
       callcontainer.clear();
+      mSizeEstimate.update(counter);
+      callcontainer.reserve(mSizeEstimate.get());
+      mBufferGrowths = 0;
     }
+    counter = 0;
+    // keep sizes and names, only reset the counts
+    std::fill(volumetosteps.begin(), volumetosteps.end(), 0);
+    mStats.clear();
+    mLastStep = -1;
+    mCallsInStep = 0;
   }
 
   void flush()
   {
     if (mTTreeIO) {
-      flushToTTree("Calls", &callcontainer);
+      // the calls were written together with the steps
+      std::cerr << "[FIELDLOGGER]: call buffer grew " << mBufferGrowths << " times\n";
     } else {
       std::cerr << "[FIELDLOGGER]: did " << counter << " steps \n";
       // summarize steps per volume
-      for (auto& p : volumetosteps) {
-        std::cerr << "[FIELDLOGGER]: VolName " << idtovolname[p.first] << " COUNT " << p.second;
+      for (int id = 0; id < volumetosteps.size(); ++id) {
+        if (volumetosteps[id] == 0) {
+          continue;
+        }
+        std::cerr << "[FIELDLOGGER]: VolName " << idtovolname[id] << " COUNT " << volumetosteps[id];
         std::cerr << "\n";
       }
+    }
+    if (mTiming) {
+      finishStep();
+      printStats();
+    }
+    if (mCache) {
+      printCacheStats();
+    }
+    if (!mTTreeIO) {
       std::cerr << "[FIELDLOGGER]: ----- END OF EVENT ------\n";
     }
     clear();
@@ -196,96 +1371,273 @@ class StepLogger
 {
   int stepcounter = 0;
 
-  std::set<int> trackset;
-  std::set<int> pdgset;
-  std::map<int, int> volumetosteps;
-  std::map<int, std::string> idtovolname;
-  std::map<int, int> volumetoNSecondaries;            // number of secondaries created in this volume
-  std::map<std::pair<int, int>, int> volumetoProcess; // mapping of volumeid x processID to secondaries produced
+  // the interactive summary only uses flat containers which are kept between events
+  std::vector<bool> trackset; // indexed by track number
+  int ntracks = 0;
+  FlatIntSet pdgset;
+  // dense, indexed by volume id
+  std::vector<int> volumetosteps;
+  std::vector<std::string> idtovolname;
+  std::vector<int> volumetoNSecondaries; // number of secondaries created in this volume
+  std::vector<double> volumetotime;      // time spent in this volume if timing is enabled
+  std::vector<int> volumetoProcess;      // volumeid x processID matrix of secondaries produced
 
   std::vector<StepInfo> container;
+  // keeps the secondary processes of all steps in container
+  SecondaryProcessArena mArena;
+  // one record per finished track, only if the track hooks are intercepted
+  std::vector<TrackInfo> tracks;
+  TrackInfo mCurrentTrack;
+  bool mInTrack = false;
+  // primary of each track of the event, parents are transported before their secondaries
+  std::vector<int> mTrackToPrimary;
+  ContainerSizeEstimate mSizeEstimate;
+  // number of times the container had to grow during the current event
+  int mBufferGrowths = 0;
+  // blocks of the secondary arena at the beginning of the current event
+  long mArenaBlocks = 0;
   bool mTTreeIO = false;
+  StepFilter mFilter;
+  StepSampler mSampler;
+  // only set if the logger measures itself
+  LoggerStats* mStats = nullptr;
+  // whether the last step was logged, field calls are attributed to it
+  bool mCurrentStepLogged = true;
+  // measure the time between consecutive steps
+  bool mTiming = false;
+  double mSecondsPerCycle = 0.;
+  unsigned long long mLastStepEnd = 0;
+  // the container does not grow much beyond the steps fitting into the memory budget
+  std::size_t mMaxChunkSteps = 0;
 
  public:
   StepLogger()
   {
     // check if streaming or interactive
     // configuration done via env variable
-    if (std::getenv("MCSTEPLOG_TTREE")) {
+    if (isFileOutput()) {
       mTTreeIO = true;
+      StepInfo::secondaryarena = &mArena;
+      if (auto budget = getMemoryBudget()) {
+        mMaxChunkSteps = budget / sizeof(StepInfo);
+      }
     }
     // try to load the volumename -> modulename mapping
     initVolumeMap();
+    if (isTiming()) {
+      mTiming = true;
+      mSecondsPerCycle = 1. / cyclesPerSecond();
+    }
   }
 
   void addStep(TVirtualMC* mc)
   {
+    if (!mTiming) {
+      logStep(mc, 0.);
+      return;
+    }
+    // time spent by the engine since the end of the previous call, hence without the own overhead
+    auto start = readCycles();
+    float cputime = mLastStepEnd > 0 ? (start - mLastStepEnd) * mSecondsPerCycle : 0.;
+    logStep(mc, cputime);
+    mLastStepEnd = readCycles();
+  }
+
+  void logStep(TVirtualMC* mc, float cputime)
+  {
+    // the track record counts all steps
+    if (mInTrack) {
+      mCurrentTrack.nsteps++;
+    }
+    if (mTTreeIO) {
+      mSampler.followTrack(mc);
+    }
+    // decide before anything is constructed or counted
+    mCurrentStepLogged = mFilter.accept(mc) && (!mTTreeIO || mSampler.accept(mc));
+    if (!mCurrentStepLogged) {
+      return;
+    }
     if (mTTreeIO) {
+      stepcounter++;
+      if (container.size() == container.capacity()) {
+        mBufferGrowths++;
+        // grow explicitly (as the vector would) such that it can be measured separately
+        auto growthstart = mStats ? readCycles() : 0;
+        auto capacity = std::max<std::size_t>(2 * container.capacity(), 16);
+        if (container.capacity() < mMaxChunkSteps) {
+          capacity = std::min(capacity, mMaxChunkSteps);
+        }
+        container.reserve(capacity);
+        if (mStats) {
+          mStats->growth += readCycles() - growthstart;
+        }
+      }
       container.emplace_back(mc);
+      container.back().weight = mSampler.weight();
+      container.back().cputime = cputime;
     } else {
       assert(mc);
       stepcounter++;
 
       auto stack = mc->GetStack();
       assert(stack);
-      trackset.insert(stack->GetCurrentTrackNumber());
+      auto track = stack->GetCurrentTrackNumber();
+      if (track >= 0) {
+        ensureIndex(trackset, track);
+        if (!trackset[track]) {
+          trackset[track] = true;
+          ntracks++;
+        }
+      }
       pdgset.insert(mc->TrackPid());
       int copyNo;
       auto id = mc->CurrentVolID(copyNo);
-
-      TArrayI procs;
-      mc->StepProcesses(procs);
-
-      if (volumetosteps.find(id) == volumetosteps.end()) {
-        volumetosteps.insert(std::pair<int, int>(id, 0));
-      } else {
-        volumetosteps[id]++;
+      if (id < 0) {
+        return;
       }
-      if (idtovolname.find(id) == idtovolname.end()) {
-        idtovolname.insert(std::pair<int, std::string>(id, std::string(mc->CurrentVolName())));
+
+      ensureIndex(volumetosteps, id);
+      volumetosteps[id]++;
+      ensureIndex(idtovolname, id);
+      if (idtovolname[id].empty()) {
+        idtovolname[id] = mc->CurrentVolName();
       }
 
       // for the secondaries
-      if (volumetoNSecondaries.find(id) == volumetoNSecondaries.end()) {
-        volumetoNSecondaries.insert(std::pair<int, int>(id, mc->NSecondaries()));
-      } else {
-        volumetoNSecondaries[id] += mc->NSecondaries();
+      auto nsecondaries = mc->NSecondaries();
+      ensureIndex(volumetoNSecondaries, id);
+      volumetoNSecondaries[id] += nsecondaries;
+      if (mTiming) {
+        ensureIndex(volumetotime, id);
+        volumetotime[id] += cputime;
       }
 
       // for the processes
-      for (int i = 0; i < mc->NSecondaries(); ++i) {
-        auto process = mc->ProdProcess(i);
-        auto p = std::pair<int, int>(id, process);
-        if (volumetoProcess.find(p) == volumetoProcess.end()) {
-          volumetoProcess.insert(std::pair<std::pair<int, int>, int>(p, 1));
-        } else {
-          volumetoProcess[p]++;
+      if (nsecondaries > 0) {
+        ensureIndex(volumetoProcess, id, kMaxMCProcess);
+        auto row = volumetoProcess.data() + id * kMaxMCProcess;
+        for (int i = 0; i < nsecondaries; ++i) {
+          auto process = mc->ProdProcess(i);
+          if (process >= 0 && process < kMaxMCProcess) {
+            row[process]++;
+          }
         }
       }
     }
   }
 
+  // start the record of the track about to be transported
+  void beginTrack(TVirtualMC* mc)
+  {
+    if (!mTTreeIO) {
+      return;
+    }
+    StepInfo::tracksrecorded = true;
+    auto stack = mc->GetStack();
+    auto& track = mCurrentTrack;
+    track = TrackInfo();
+    track.trackID = stack->GetCurrentTrackNumber();
+    track.pdg = mc->TrackPid();
+    track.parent = stack->GetCurrentTrack()->IsPrimary() ? -1 : stack->GetCurrentParentTrackNumber();
+    track.primary = track.parent;
+    if (track.parent < 0) {
+      track.primary = track.trackID;
+    } else if (track.parent < mTrackToPrimary.size() && mTrackToPrimary[track.parent] >= 0) {
+      track.primary = mTrackToPrimary[track.parent];
+    }
+    if (track.trackID >= 0) {
+      if (track.trackID >= mTrackToPrimary.size()) {
+        mTrackToPrimary.resize(track.trackID + 1, -1);
+      }
+      mTrackToPrimary[track.trackID] = track.primary;
+    }
+    double x, y, z;
+    mc->TrackPosition(x, y, z);
+    track.x = x;
+    track.y = y;
+    track.z = z;
+    track.E = mc->Etot();
+    mInTrack = true;
+  }
+
+  void endTrack(TVirtualMC* mc)
+  {
+    if (!mInTrack) {
+      return;
+    }
+    mCurrentTrack.length = mc->TrackLength();
+    tracks.push_back(mCurrentTrack);
+    mInTrack = false;
+  }
+
+  std::vector<StepInfo>* getContainer() { return &container; }
+  std::vector<TrackInfo>* getTracks() { return &tracks; }
+  SecondaryProcessArena& getArena() { return mArena; }
+
+  // memory taken by the steps of the current chunk
+  std::size_t memoryUsage() const
+  {
+    return container.size() * sizeof(StepInfo) + mArena.used() + tracks.size() * sizeof(TrackInfo);
+  }
+
+  // the steps were written as a chunk, the event continues with the same step ids
+  void clearChunk()
+  {
+    container.clear();
+    mArena.reset();
+    tracks.clear();
+  }
+
+  bool isCurrentStepLogged() const { return mCurrentStepLogged; }
+  // number of steps logged in this event
+  int getStepCounter() const { return stepcounter; }
+  void setStats(LoggerStats* stats) { mStats = stats; }
+  float currentWeight() const { return mSampler.weight(); }
+  SamplingMode samplingMode() const { return mTTreeIO ? mSampler.mode() : SamplingMode::kNone; }
+
+  // times the step container or the secondary arena grew during the current event; this only covers
+  // these buffers, other allocations on the stepping path are not counted, e.g. interning the names
+  // of new volumes, growing the lookup vectors or allocations done by the engine or by ROOT
+  long bufferGrowths() const { return mBufferGrowths + mArena.heapAllocations() - mArenaBlocks; }
+
   void clear()
   {
-    stepcounter = 0;
-    trackset.clear();
-    pdgset.clear();
-    volumetosteps.clear();
-    idtovolname.clear();
-    volumetoNSecondaries.clear();
-    volumetoProcess.clear();
     if (mTTreeIO) {
       container.clear();
+      mArena.reset();
+      tracks.clear();
+      mTrackToPrimary.clear();
+      mSizeEstimate.update(stepcounter);
+      container.reserve(mMaxChunkSteps > 0 ? std::min(mSizeEstimate.get(), mMaxChunkSteps) : mSizeEstimate.get());
+      mBufferGrowths = 0;
+      mArenaBlocks = mArena.heapAllocations();
+      mSampler.nextEvent();
     }
+    mCurrentStepLogged = true;
+    // the time between events is not attributed to any step
+    mLastStepEnd = 0;
+    stepcounter = 0;
+    // keep sizes and names, only reset the counts
+    std::fill(trackset.begin(), trackset.end(), false);
+    ntracks = 0;
+    pdgset.clear();
+    std::fill(volumetosteps.begin(), volumetosteps.end(), 0);
+    std::fill(volumetoNSecondaries.begin(), volumetoNSecondaries.end(), 0);
+    std::fill(volumetotime.begin(), volumetotime.end(), 0.);
+    std::fill(volumetoProcess.begin(), volumetoProcess.end(), 0);
     StepInfo::resetCounter();
   }
 
   // prints list of processes for volumeID
   void printProcesses(int volid)
   {
-    for (auto& p : volumetoProcess) {
-      if (p.first.first == volid) {
-        std::cerr << "P[" << TMCProcessName[p.first.second] << "]:" << p.second << "\t";
+    if ((volid + 1) * kMaxMCProcess > volumetoProcess.size()) {
+      return;
+    }
+    auto row = volumetoProcess.data() + volid * kMaxMCProcess;
+    for (int process = 0; process < kMaxMCProcess; ++process) {
+      if (row[process] > 0) {
+        std::cerr << "P[" << TMCProcessName[process] << "]:" << row[process] << "\t";
       }
     }
   }
@@ -294,20 +1646,27 @@ class StepLogger
   {
     if (!mTTreeIO) {
       std::cerr << "[STEPLOGGER]: did " << stepcounter << " steps \n";
-      std::cerr << "[STEPLOGGER]: transported " << trackset.size() << " different tracks \n";
+      std::cerr << "[STEPLOGGER]: transported " << ntracks << " different tracks \n";
       std::cerr << "[STEPLOGGER]: transported " << pdgset.size() << " different types \n";
       // summarize steps per volume
-      for (auto& p : volumetosteps) {
-        std::cerr << "[STEPLOGGER]: VolName " << idtovolname[p.first] << " COUNT " << p.second << " SECONDARIES "
-                  << volumetoNSecondaries[p.first] << " ";
+      for (int id = 0; id < volumetosteps.size(); ++id) {
+        if (volumetosteps[id] == 0) {
+          continue;
+        }
+        std::cerr << "[STEPLOGGER]: VolName " << idtovolname[id] << " COUNT " << volumetosteps[id] << " SECONDARIES "
+                  << volumetoNSecondaries[id] << " ";
+        if (mTiming && id < volumetotime.size()) {
+          std::cerr << "TIME " << 1000. * volumetotime[id] << " ms ";
+        }
         // loop over processes
-        printProcesses(p.first);
+        printProcesses(id);
         std::cerr << "\n";
       }
       std::cerr << "[STEPLOGGER]: ----- END OF EVENT ------\n";
     } else {
-      flushToTTree("Steps", &container);
-      flushToTTree("Lookups", &StepInfo::lookupstructures);
+      std::cerr << "[STEPLOGGER]: step buffer and arena grew " << bufferGrowths() << " times while logging "
+                << stepcounter << " steps\n";
+      // steps and lookups were written to the output tree before,
       // we need to reset some parts of the lookupstructures for the next event
       StepInfo::lookupstructures.tracktoparent.clear();
       StepInfo::lookupstructures.tracktopdg.clear();
@@ -316,98 +1675,385 @@ class StepLogger
   }
 };
 
-// the global logging instances (in anonymous namespace)
-// pointers to dissallow construction at each library load
-StepLogger* logger;
-FieldLogger* fieldlogger;
-} // end namespace
+// the logging instances, one per thread so that workers of multithreaded engines
+// do not share any state; created on first use in each thread
+thread_local StepLogger* logger = nullptr;
+thread_local FieldLogger* fieldlogger = nullptr;
+thread_local int workerid = -1;
+thread_local EventHeader eventheader;
+std::atomic<int> nworkers{ 0 };
+// when this thread last wrote an event or chunk
+thread_local std::chrono::steady_clock::time_point lastwritetime;
 
-// a helper template kernel describing generically the redispatching prodecure
-template <typename Object /* the original object type */, typename MethodType /* member function type */,
-          typename... Args /* original arguments to function */>
-void dispatchOriginalKernel(Object* obj, char const* libname, char const* origFunctionName, Args... args)
-{
-  // Object, MethodType, and Args are of course related so we could do some static_assert checks or automatic deduction
-
-  // static map to avoid having to lookup the right symbols in the shared lib at each call
-  // (We could do this outside of course)
-  static std::map<const char*, MethodType> functionNameToSymbolMap;
-  MethodType origMethod = nullptr;
-
-  auto iter = functionNameToSymbolMap.find(origFunctionName);
-  if (iter == functionNameToSymbolMap.end()) {
-    auto libHandle = dlopen(libname, RTLD_NOW);
-    // try to make the library loading a bit more portable:
-    if (!libHandle) {
-      // try appending *.so
-      std::stringstream stream;
-      stream << libname << ".so";
-      libHandle = dlopen(stream.str().c_str(), RTLD_NOW);
-    }
-    if (!libHandle) {
-      // try appending *.dylib
-      std::stringstream stream;
-      stream << libname << ".dylib";
-      libHandle = dlopen(stream.str().c_str(), RTLD_NOW);
-    }
-    assert(libHandle);
-    void* symbolAddress = dlsym(libHandle, origFunctionName);
-    assert(symbolAddress);
-// Purposely ignore compiler warning
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wsizeof-pointer-memaccess"
-    // hack since C++ does not allow casting to C++ member function pointers
-    // thanks to gist.github.com/mooware/1174572
-    memcpy(&origMethod, &symbolAddress, sizeof(&symbolAddress));
-#pragma GCC diagnostic pop
-    functionNameToSymbolMap[origFunctionName] = origMethod;
-  } else {
-    origMethod = iter->second;
+// overhead of the current event and of the previous flush of this thread
+thread_local LoggerStats eventstats;
+thread_local unsigned long long lastflushcycles = 0;
+// summed over all events of all threads
+LoggerStats runstats;
+std::mutex runstatsmutex;
+
+// only present when logging to one file shared by all workers
+LoggerOutput* output = nullptr;
+// serializes writing of events to the shared output if not done asynchronously
+std::mutex outputmutex;
+// only present when the output is written asynchronously
+AsyncWriter* asyncwriter = nullptr;
+// events exceeding this are flushed in chunks, 0 if unlimited
+std::size_t memorybudget = 0;
+// whether the interceptors time the original Field(), set once the logger is initialized
+std::atomic<bool> fieldtimed{ false };
+// per-thread files, closed together at exit
+thread_local LoggerOutput* workeroutput = nullptr;
+std::vector<LoggerOutput*> workeroutputs;
+std::mutex workeroutputsmutex;
+
+void initWorker()
+{
+  workerid = nworkers++;
+  lastwritetime = std::chrono::steady_clock::now();
+  logger = new StepLogger();
+  fieldlogger = new FieldLogger();
+  if (StepInfo::instrumented) {
+    eventstats.cyclespersecond = cyclesPerSecond();
+    logger->setStats(&eventstats);
+  }
+}
+
+StepLogger& getLogger()
+{
+  if (!logger) {
+    initWorker();
+  }
+  return *logger;
+}
+
+FieldLogger& getFieldLogger()
+{
+  if (!fieldlogger) {
+    initWorker();
+  }
+  return *fieldlogger;
+}
+
+// the containers of the current event of this thread
+EventData getEventData()
+{
+  EventData data{ &eventheader, getLogger().getContainer(), getFieldLogger().getContainer(), &StepInfo::lookupstructures };
+  if (StepInfo::instrumented) {
+    data.stats = &eventstats;
+  }
+  data.callsummaries = getFieldLogger().getSummaries();
+  data.tracks = getLogger().getTracks();
+  data.fieldstats = getFieldLogger().getStats();
+  return data;
+}
+
+// the output file of the current worker in case of per-thread output
+LoggerOutput* getWorkerOutput()
+{
+  if (!workeroutput) {
+    auto filename = getWorkerLogFileName(workerid);
+    std::cerr << "[MCLOGGER:] WORKER " << workerid << " WRITES TO " << filename << "\n";
+    if (isBinaryOutput()) {
+      auto binaryoutput = new BinaryOutput();
+      binaryoutput->open(filename);
+      workeroutput = binaryoutput;
+    } else {
+      auto treeoutput = new TTreeOutput();
+      treeoutput->open(filename, getEventData());
+      workeroutput = treeoutput;
+    }
+    std::lock_guard<std::mutex> lock(workeroutputsmutex);
+    workeroutputs.push_back(workeroutput);
+  }
+  return workeroutput;
+}
+
+// hand the containers of this thread over to the output
+void writeEventData(EventData data)
+{
+  auto now = std::chrono::steady_clock::now();
+  data.walltime = std::chrono::duration<float>(now - lastwritetime).count();
+  lastwritetime = now;
+  if (isFileOutput() && isPerThreadOutput()) {
+    getWorkerOutput()->fill(data);
+  } else if (asyncwriter) {
+    asyncwriter->push(data, getLogger().getArena());
+  } else if (output) {
+    std::lock_guard<std::mutex> lock(outputmutex);
+    output->fill(data);
+  }
+}
+
+// write the steps collected so far as a chunk of the current event
+void flushChunk()
+{
+  eventheader.eventid = TVirtualMC::GetMC()->CurrentEvent();
+  eventheader.workerid = workerid;
+  eventheader.lastchunk = false;
+  eventheader.sampling = static_cast<int>(getLogger().samplingMode());
+  std::cerr << "[MCLOGGER:] MEMORY BUDGET EXCEEDED, FLUSHING CHUNK " << eventheader.chunk << " OF EVENT "
+            << eventheader.eventid << "\n";
+  // the statistics cover the whole event and are only written with its last chunk, the other
+  // chunks carry empty ones such that summing over the entries of an event gives its totals
+  static thread_local LoggerStats nostats;
+  static thread_local FieldStats nofieldstats;
+  auto data = getEventData();
+  if (data.stats) {
+    nostats.cyclespersecond = data.stats->cyclespersecond;
+    data.stats = &nostats;
+  }
+  if (data.fieldstats) {
+    data.fieldstats = &nofieldstats;
   }
-  // the final C++ member function call redispatch
-  (obj->*origMethod)(args...);
+  writeEventData(data);
+  eventheader.chunk++;
+  getLogger().clearChunk();
+  getFieldLogger().clearChunk();
+  // the tracks of the next chunk are collected from scratch
+  StepInfo::lookupstructures.tracktopdg.clear();
+  StepInfo::lookupstructures.tracktoparent.clear();
 }
 
-// a generic function that can dispatch to the original method of a TVirtualMCApplication
-extern "C" void dispatchOriginal(TVirtualMCApplication* app, char const* libname, char const* origFunctionName)
+// checked before a step is logged, hence the field calls of the previous step
+// still go to the same chunk as the step
+void checkMemoryBudget()
 {
-  typedef void (TVirtualMCApplication::*StepMethodType)();
-  dispatchOriginalKernel<TVirtualMCApplication, StepMethodType>(app, libname, origFunctionName);
+  // the usage is only computed every so many steps
+  static thread_local int countdown = 0;
+  if (--countdown > 0) {
+    return;
+  }
+  countdown = 1024;
+  if (getLogger().memoryUsage() + getFieldLogger().memoryUsage() > memorybudget) {
+    flushChunk();
+  }
 }
+} // end namespace
 
-// a generic function that can dispatch to the original method of a TVirtualMagField
-extern "C" void dispatchOriginalField(TVirtualMagField* field, char const* libname, char const* origFunctionName,
-                                      const double x[3], double* B)
+// resolves the address of an original symbol in its shared library
+// this is done only once per intercepted method, the caller keeps the result
+extern "C" void* resolveOriginalSymbol(char const* libname, char const* origFunctionName)
 {
-  typedef void (TVirtualMagField::*MethodType)(const double[3], double*);
-  dispatchOriginalKernel<TVirtualMagField, MethodType>(field, libname, origFunctionName, x, B);
+  auto libHandle = dlopen(libname, RTLD_NOW);
+  // try to make the library loading a bit more portable:
+  if (!libHandle) {
+    // try appending *.so
+    std::stringstream stream;
+    stream << libname << ".so";
+    libHandle = dlopen(stream.str().c_str(), RTLD_NOW);
+  }
+  if (!libHandle) {
+    // try appending *.dylib
+    std::stringstream stream;
+    stream << libname << ".dylib";
+    libHandle = dlopen(stream.str().c_str(), RTLD_NOW);
+  }
+  assert(libHandle);
+  void* symbolAddress = dlsym(libHandle, origFunctionName);
+  assert(symbolAddress);
+  return symbolAddress;
 }
 
 extern "C" void performLogging(TVirtualMCApplication* app)
 {
-  static TVirtualMC* mc = TVirtualMC::GetMC();
-  o2::logger->addStep(mc);
+  // the engine instance is per thread for multithreaded engines
+  static thread_local TVirtualMC* mc = TVirtualMC::GetMC();
+  if (o2::memorybudget > 0) {
+    o2::checkMemoryBudget();
+  }
+  if (!o2::StepInfo::instrumented) {
+    o2::getLogger().addStep(mc);
+    return;
+  }
+  auto start = o2::readCycles();
+  o2::getLogger().addStep(mc);
+  // lookups and growth are separated at the end of the event
+  o2::eventstats.capture += o2::readCycles() - start;
+  o2::eventstats.nsteps++;
+}
+
+extern "C" void beginTrack()
+{
+  static thread_local TVirtualMC* mc = TVirtualMC::GetMC();
+  auto start = o2::StepInfo::instrumented ? o2::readCycles() : 0;
+  o2::getLogger().beginTrack(mc);
+  if (o2::StepInfo::instrumented) {
+    o2::eventstats.capture += o2::readCycles() - start;
+  }
+}
+
+extern "C" void endTrack()
+{
+  static thread_local TVirtualMC* mc = TVirtualMC::GetMC();
+  auto start = o2::StepInfo::instrumented ? o2::readCycles() : 0;
+  o2::getLogger().endTrack(mc);
+  if (o2::StepInfo::instrumented) {
+    o2::eventstats.capture += o2::readCycles() - start;
+  }
+}
+
+// cycles is the time spent in the original Field() call, 0 if not measured
+extern "C" void logField(double const* p, double const* b, unsigned long long cycles)
+{
+  static thread_local TVirtualMC* mc = TVirtualMC::GetMC();
+  auto start = o2::StepInfo::instrumented ? o2::readCycles() : 0;
+  auto& logger = o2::getLogger();
+  auto& fieldlogger = o2::getFieldLogger();
+  if (fieldlogger.isCacheSimulated()) {
+    fieldlogger.queryCache(mc, p);
+  }
+  // calls are attributed to the last step and dropped if that was not logged
+  if (logger.isCurrentStepLogged()) {
+    fieldlogger.addStep(mc, p, b, logger.currentWeight(), cycles, logger.getStepCounter());
+  }
+  if (o2::StepInfo::instrumented) {
+    o2::eventstats.field += o2::readCycles() - start;
+    o2::eventstats.fieldoriginal += cycles;
+    o2::eventstats.nfieldcalls++;
+  }
+}
+
+// the time spent in the original methods is passed from the interceptors for comparison
+extern "C" bool isLoggerInstrumented()
+{
+  return o2::StepInfo::instrumented;
+}
+
+extern "C" bool isFieldTimed()
+{
+  return o2::fieldtimed;
+}
+
+extern "C" void addOriginalSteppingCycles(unsigned long long cycles)
+{
+  o2::eventstats.stepping += cycles;
 }
 
-extern "C" void logField(double const* p, double const* b)
+extern "C" void closeLogger()
 {
-  static TVirtualMC* mc = TVirtualMC::GetMC();
-  o2::fieldlogger->addStep(mc, p, b);
+  if (o2::asyncwriter) {
+    // write pending events first
+    o2::asyncwriter->stop();
+  }
+  if (o2::output) {
+    std::cerr << "[MCLOGGER:] CLOSING OUTPUT FILE " << o2::getLogFileName() << "\n";
+    o2::output->close();
+  }
+  // worker threads are done at this point
+  std::lock_guard<std::mutex> lock(o2::workeroutputsmutex);
+  for (auto workeroutput : o2::workeroutputs) {
+    workeroutput->close();
+  }
+  if (o2::workeroutputs.size() > 0) {
+    std::cerr << "[MCLOGGER:] CLOSED " << o2::workeroutputs.size() << " WORKER OUTPUT FILES\n";
+  }
+  if (o2::StepInfo::instrumented) {
+    std::lock_guard<std::mutex> statslock(o2::runstatsmutex);
+    o2::runstats.print("RUN");
+  }
 }
 
 extern "C" void initLogger()
 {
-  // init TFile for logging output
-  o2::initTFile();
-  // initializes the logging instances
-  o2::logger = new o2::StepLogger();
-  o2::fieldlogger = new o2::FieldLogger();
+  o2::StepInfo::instrumented = o2::isInstrumented();
+  o2::fieldtimed = o2::StepInfo::instrumented || o2::isFieldTiming();
+  if (o2::StepInfo::instrumented) {
+    std::cerr << "[MCLOGGER:] MEASURING OVERHEAD, " << o2::cyclesPerSecond() << " CYCLES PER SECOND\n";
+  }
+  if (o2::isTiming()) {
+    // calibrate the clock once before the first step
+    std::cerr << "[MCLOGGER:] MEASURING TIME PER STEP, " << o2::cyclesPerSecond() << " CYCLES PER SECOND\n";
+  }
+  // all volumes are known from now on, the volume map is needed to resolve their modules
+  o2::initVolumeMap();
+  if (auto nvolumes = o2::StepInfo::initGeometryLookups()) {
+    std::cerr << "[MCLOGGER:] LOOKUPS OF " << nvolumes << " VOLUMES BUILT FROM THE GEOMETRY\n";
+  }
+  // closeLogger finishes the online analyses, hence the analysis manager has to be constructed before the
+  // handler is registered: the handler then runs before the manager is destroyed at exit
+  if (o2::isOnlineOutput()) {
+    o2::mcstepanalysis::MCAnalysisManager::Instance();
+  }
+  // closes output files and prints the run summary
+  std::atexit(closeLogger);
+  // initializes the logging instances of this thread, worker threads do so on their first step
+  o2::getLogger();
+  o2::getFieldLogger();
+  if (!o2::isFileOutput()) {
+    return;
+  }
+  o2::memorybudget = o2::getMemoryBudget();
+  if (o2::memorybudget > 0) {
+    std::cerr << "[MCLOGGER:] EVENTS ABOVE " << (o2::memorybudget >> 20) << " MB ARE FLUSHED IN CHUNKS\n";
+  }
+  if (std::getenv("MCSTEPLOG_AGGREGATECALLS") && !o2::isAggregatedCalls()) {
+    std::cerr << "[MCLOGGER:] AGGREGATED FIELD CALLS ARE ONLY SUPPORTED BY THE TREE OUTPUT, WRITING SINGLE CALLS\n";
+  }
+  if (o2::isPerThreadOutput()) {
+    // files are opened by each worker, ROOT I/O is then done from several threads
+    ROOT::EnableThreadSafety();
+  } else {
+    // init output file for logging which stays open until the process exits
+    if (o2::isOnlineOutput()) {
+      auto onlineoutput = new o2::OnlineOutput();
+      onlineoutput->open();
+      o2::output = onlineoutput;
+    } else if (o2::isStreamOutput()) {
+      auto streamoutput = new o2::StreamOutput();
+      streamoutput->open();
+      o2::output = streamoutput;
+    } else if (o2::isBinaryOutput()) {
+      auto binaryoutput = new o2::BinaryOutput();
+      binaryoutput->open(o2::getLogFileName());
+      o2::output = binaryoutput;
+    } else {
+      auto treeoutput = new o2::TTreeOutput();
+      treeoutput->open(o2::getLogFileName(), o2::getEventData());
+      o2::output = treeoutput;
+    }
+    if (std::getenv("MCSTEPLOG_ASYNC")) {
+      // I/O is done from a second thread
+      ROOT::EnableThreadSafety();
+      o2::asyncwriter = new o2::AsyncWriter(*o2::output, o2::getAsyncQueueDepth());
+    }
+  }
 }
 
 extern "C" void flushLog()
 {
   std::cerr << "[MCLOGGER:] START FLUSHING ----\n";
-  o2::logger->flush();
-  o2::fieldlogger->flush();
+  auto start = o2::StepInfo::instrumented ? o2::readCycles() : 0;
+  auto& logger = o2::getLogger();
+  auto& fieldlogger = o2::getFieldLogger();
+  auto& stats = o2::eventstats;
+  fieldlogger.finishStep();
+  if (o2::StepInfo::instrumented) {
+    stats.lookups = o2::StepInfo::lookupcycles;
+    stats.capture -= std::min(stats.capture, stats.lookups + stats.growth);
+    // the flush of this event is still ongoing when it is written
+    stats.flush = o2::lastflushcycles;
+  }
+  if (o2::isFileOutput()) {
+    o2::eventheader.eventid = TVirtualMC::GetMC()->CurrentEvent();
+    o2::eventheader.workerid = o2::workerid;
+    o2::eventheader.lastchunk = true;
+  }
+  o2::eventheader.sampling = static_cast<int>(logger.samplingMode());
+  o2::writeEventData(o2::getEventData());
+  o2::eventheader.chunk = 0;
+  logger.flush();
+  fieldlogger.flush();
+  if (o2::StepInfo::instrumented) {
+    o2::lastflushcycles = o2::readCycles() - start;
+    stats.flush = o2::lastflushcycles;
+    stats.print("EVENT");
+    {
+      std::lock_guard<std::mutex> lock(o2::runstatsmutex);
+      o2::runstats.add(stats);
+    }
+    stats.reset();
+    o2::StepInfo::lookupcycles = 0;
+  }
   std::cerr << "[MCLOGGER:] END FLUSHING ----\n";
 }
@@ -16,16 +16,27 @@
 
 #pragma link C++ class o2::StepInfo+;
 #pragma link C++ class o2::MagCallInfo+;
+#pragma link C++ class o2::MagCallSummary+;
+#pragma link C++ class o2::TrackInfo+;
+#pragma link C++ class o2::EventHeader+;
+#pragma link C++ class o2::LoggerStats+;
+#pragma link C++ class o2::FieldStats+;
 #pragma link C++ class std::vector<o2::StepInfo>+;
 #pragma link C++ class std::vector<o2::MagCallInfo>+;
+#pragma link C++ class std::vector<o2::MagCallSummary>+;
+#pragma link C++ class std::vector<o2::TrackInfo>+;
 #pragma link C++ class std::vector<o2::StepInfo*>+;
 #pragma link C++ class std::vector<o2::MagCallInfo*>+;
 #pragma link C++ class std::vector<TGeoVolume const *>+;
 #pragma link C++ class std::vector<std::vector<TGeoVolume const *> *>+;
 #pragma link C++ class o2::VolInfoContainer+;
 #pragma link C++ class o2::StepLookups+;
+#pragma link C++ class o2::EventIndexEntry+;
+#pragma link C++ class std::vector<o2::EventIndexEntry>+;
+#pragma link C++ class o2::StepLoggerIndex+;
 #pragma link C++ class o2::mcstepanalysis::MCAnalysis + ;
 #pragma link C++ class o2::mcstepanalysis::BasicMCAnalysis + ;
+#pragma link C++ class o2::mcstepanalysis::TimingMCAnalysis + ;
 #pragma link C++ class o2::mcstepanalysis::MCStepLoggerMetaInfo + ;
 #pragma link C++ class o2::mcstepanalysis::MCAnalysisMetaInfo + ;
 #pragma link C++ class o2::mcstepanalysis::MCAnalysisManager + ;
@@ -0,0 +1,365 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+
+//  @file   SharedMemoryStream.cxx
+//  @brief  single producer, single consumer ring buffer in POSIX shared memory
+
+#include "MCStepLogger/SharedMemoryStream.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace o2
+{
+// positions are counted in bytes since the creation and only ever grow,
+// the offset in the ring is the position modulo the capacity
+struct SharedMemoryRingHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t flags; // binary format flags of the encoded events
+  uint64_t capacity;
+  std::atomic<uint64_t> head; // end of the published events, written by the producer
+  std::atomic<uint64_t> tail; // end of the consumed events, written by the consumer
+  std::atomic<uint64_t> dropped;
+  std::atomic<uint32_t> consumer; // see ConsumerState
+  std::atomic<uint32_t> closed;   // no more events follow
+};
+
+// the atomics are shared between processes, hence they must not rely on a lock
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "lock-free 64 bit atomics required");
+
+namespace
+{
+enum ConsumerState : uint32_t {
+  kNone = 0,
+  kRequested = 1, // consumer waits for the producer to start a fresh stream for it
+  kAttached = 2
+};
+
+// type (fixed32) + payload size (fixed64) in front of each chunk
+constexpr std::size_t CHUNKHEADERSIZE = 12;
+// a producer blocked for longer assumes that the consumer died
+constexpr auto MAXBLOCKTIME = std::chrono::seconds(10);
+
+uint64_t readLittleEndian(const char* p, int nbytes)
+{
+  uint64_t v = 0;
+  for (int i = 0; i < nbytes; ++i) {
+    v |= static_cast<uint64_t>(static_cast<unsigned char>(p[i])) << (8 * i);
+  }
+  return v;
+}
+} // namespace
+
+SharedMemoryStreamWriter::~SharedMemoryStreamWriter()
+{
+  close();
+}
+
+bool SharedMemoryStreamWriter::create(std::string const& name, std::size_t capacity, bool dropWhenFull,
+                                      bool float16Energy)
+{
+  close();
+  // a segment left behind by a crashed run is replaced
+  shm_unlink(name.c_str());
+  int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0) {
+    std::cerr << "[MCLOGGER:] CANNOT CREATE SHARED MEMORY " << name << "\n";
+    return false;
+  }
+  auto size = sizeof(SharedMemoryRingHeader) + capacity;
+  if (ftruncate(fd, size) != 0) {
+    std::cerr << "[MCLOGGER:] CANNOT RESIZE SHARED MEMORY " << name << " TO " << size << " BYTES\n";
+    ::close(fd);
+    shm_unlink(name.c_str());
+    return false;
+  }
+  auto data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (data == MAP_FAILED) {
+    std::cerr << "[MCLOGGER:] CANNOT MAP SHARED MEMORY " << name << "\n";
+    shm_unlink(name.c_str());
+    return false;
+  }
+  mHeader = new (data) SharedMemoryRingHeader;
+  mRing = static_cast<char*>(data) + sizeof(SharedMemoryRingHeader);
+  mMappedSize = size;
+  mName = name;
+  mDropWhenFull = dropWhenFull;
+  mFloat16Energy = float16Energy;
+  resetEncoder();
+
+  mHeader->version = shmstream::VERSION;
+  mHeader->flags = float16Energy ? binaryformat::FLAGFLOAT16ENERGY : 0;
+  mHeader->capacity = capacity;
+  mHeader->head.store(0);
+  mHeader->tail.store(0);
+  mHeader->dropped.store(0);
+  mHeader->consumer.store(kNone);
+  mHeader->closed.store(0);
+  // the magic is written last, a consumer only accepts a completely initialized header
+  std::atomic_thread_fence(std::memory_order_release);
+  std::memcpy(mHeader->magic, shmstream::MAGIC, sizeof(shmstream::MAGIC));
+  return true;
+}
+
+void SharedMemoryStreamWriter::drop()
+{
+  mHeader->dropped.fetch_add(1, std::memory_order_relaxed);
+  // the lookup names of the dropped event never arrive, send all of them again
+  resetEncoder();
+}
+
+void SharedMemoryStreamWriter::resetEncoder()
+{
+  mEncoder = BinaryStepEncoder(mFloat16Energy);
+  mLookupsPending = true;
+}
+
+void SharedMemoryStreamWriter::writeEvent(EventHeader const& header, std::vector<StepInfo> const& steps,
+                                          std::vector<MagCallInfo> const& calls, StepLookups const& lookups,
+                                          std::vector<TrackInfo> const* tracks)
+{
+  if (!mHeader) {
+    return;
+  }
+  auto consumer = mHeader->consumer.load(std::memory_order_acquire);
+  if (consumer == kRequested) {
+    // a new consumer starts with an empty ring and gets all lookup names
+    resetEncoder();
+    mHeader->tail.store(mHeader->head.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    mHeader->consumer.store(kAttached, std::memory_order_release);
+  } else if (consumer != kAttached) {
+    drop();
+    return;
+  }
+
+  mBuffer.clear();
+  // both chunks are published together
+  if (mLookups && mLookupsPending) {
+    mEncoder.encodeLookups(*mLookups, mBuffer);
+  }
+  mEncoder.encodeEvent(header, steps, calls, lookups, mBuffer, tracks);
+  const auto n = mBuffer.size();
+  const auto capacity = mHeader->capacity;
+  if (n > capacity) {
+    std::cerr << "[MCLOGGER:] EVENT OF " << n << " BYTES DOES NOT FIT INTO THE SHARED MEMORY OF " << capacity
+              << " BYTES\n";
+    drop();
+    return;
+  }
+
+  const auto head = mHeader->head.load(std::memory_order_relaxed);
+  auto blockStart = std::chrono::steady_clock::now();
+  while (capacity - (head - mHeader->tail.load(std::memory_order_acquire)) < n) {
+    if (mDropWhenFull || mHeader->consumer.load(std::memory_order_acquire) != kAttached) {
+      drop();
+      return;
+    }
+    if (std::chrono::steady_clock::now() - blockStart > MAXBLOCKTIME) {
+      std::cerr << "[MCLOGGER:] STREAM CONSUMER DID NOT READ FOR "
+                << std::chrono::duration_cast<std::chrono::seconds>(MAXBLOCKTIME).count() << " s, DETACHING IT\n";
+      mHeader->consumer.store(kNone, std::memory_order_release);
+      drop();
+      return;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
+
+  // the chunk may wrap around the end of the ring
+  auto offset = head % capacity;
+  auto first = std::min<uint64_t>(n, capacity - offset);
+  std::memcpy(mRing + offset, mBuffer.data(), first);
+  std::memcpy(mRing, mBuffer.data() + first, n - first);
+  mHeader->head.store(head + n, std::memory_order_release);
+  mLookupsPending = false;
+}
+
+void SharedMemoryStreamWriter::close()
+{
+  if (!mHeader) {
+    return;
+  }
+  mHeader->closed.store(1, std::memory_order_release);
+  munmap(mHeader, mMappedSize);
+  // an attached consumer keeps its mapping until it detaches
+  shm_unlink(mName.c_str());
+  mHeader = nullptr;
+  mRing = nullptr;
+  mMappedSize = 0;
+}
+
+unsigned long SharedMemoryStreamWriter::nDropped() const
+{
+  return mHeader ? mHeader->dropped.load(std::memory_order_relaxed) : 0;
+}
+
+SharedMemoryStreamReader::~SharedMemoryStreamReader()
+{
+  detach();
+}
+
+bool SharedMemoryStreamReader::attach(std::string const& name, int timeout)
+{
+  detach();
+  // the consumer may be started before the simulation
+  auto start = std::chrono::steady_clock::now();
+  int fd = -1;
+  struct stat st;
+  while (true) {
+    fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd >= 0 && fstat(fd, &st) == 0 && static_cast<std::size_t>(st.st_size) > sizeof(SharedMemoryRingHeader)) {
+      break;
+    }
+    if (fd >= 0) {
+      ::close(fd);
+    }
+    if (std::chrono::steady_clock::now() - start > std::chrono::seconds(timeout)) {
+      std::cerr << "ERROR: No step logger stream " << name << " found within " << timeout << " s\n";
+      return false;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  auto data = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (data == MAP_FAILED) {
+    std::cerr << "ERROR: Cannot map step logger stream " << name << "\n";
+    return false;
+  }
+  mHeader = static_cast<SharedMemoryRingHeader*>(data);
+  mRing = static_cast<const char*>(data) + sizeof(SharedMemoryRingHeader);
+  mMappedSize = st.st_size;
+  while (std::memcmp(mHeader->magic, shmstream::MAGIC, sizeof(shmstream::MAGIC)) != 0) {
+    if (std::chrono::steady_clock::now() - start > std::chrono::seconds(timeout)) {
+      std::cerr << "ERROR: " << name << " is not a step logger stream\n";
+      detach();
+      return false;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (mHeader->version != shmstream::VERSION) {
+    std::cerr << "ERROR: Step logger stream " << name << " has version " << mHeader->version << " instead of "
+              << shmstream::VERSION << "\n";
+    detach();
+    return false;
+  }
+  uint32_t expected = kNone;
+  if (!mHeader->consumer.compare_exchange_strong(expected, kRequested)) {
+    std::cerr << "ERROR: Another consumer is already attached to " << name << "\n";
+    // do not detach the other consumer
+    munmap(mHeader, mMappedSize);
+    mHeader = nullptr;
+    return false;
+  }
+  mDecoder = BinaryStepDecoder(mHeader->flags);
+  // the producer starts the stream for this consumer with its next event
+  while (mHeader->consumer.load(std::memory_order_acquire) == kRequested && !mHeader->closed.load()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  std::cerr << "INFO: Attached to step logger stream " << name << "\n";
+  return true;
+}
+
+void SharedMemoryStreamReader::detach()
+{
+  if (!mHeader) {
+    return;
+  }
+  mHeader->consumer.store(kNone, std::memory_order_release);
+  munmap(mHeader, mMappedSize);
+  mHeader = nullptr;
+  mRing = nullptr;
+  mMappedSize = 0;
+}
+
+void SharedMemoryStreamReader::copyFromRing(uint64_t position, char* destination, std::size_t size) const
+{
+  const auto capacity = mHeader->capacity;
+  auto offset = position % capacity;
+  auto first = std::min<uint64_t>(size, capacity - offset);
+  std::memcpy(destination, mRing + offset, first);
+  std::memcpy(destination + first, mRing, size - first);
+}
+
+bool SharedMemoryStreamReader::readNextEvent(std::vector<StepInfo>& steps, std::vector<MagCallInfo>& calls,
+                                             StepLookups& lookups, EventHeader* header,
+                                             std::vector<TrackInfo>* tracks)
+{
+  if (!mHeader) {
+    return false;
+  }
+  while (true) {
+    if (mHeader->consumer.load(std::memory_order_acquire) != kAttached) {
+      // the producer may have finished before any event was sent to this consumer
+      if (!mHeader->closed.load(std::memory_order_acquire)) {
+        std::cerr << "ERROR: Detached from the step logger stream by the producer\n";
+      }
+      return false;
+    }
+    auto tail = mHeader->tail.load(std::memory_order_relaxed);
+    auto head = mHeader->head.load(std::memory_order_acquire);
+    if (head - tail >= CHUNKHEADERSIZE) {
+      // chunks are published as a whole
+      char chunkHeader[CHUNKHEADERSIZE];
+      copyFromRing(tail, chunkHeader, CHUNKHEADERSIZE);
+      auto type = readLittleEndian(chunkHeader, 4);
+      auto size = readLittleEndian(chunkHeader + 4, 8);
+      if (CHUNKHEADERSIZE + size > head - tail) {
+        std::cerr << "ERROR: Corrupted chunk in the step logger stream\n";
+        return false;
+      }
+      mPayload.resize(size);
+      copyFromRing(tail + CHUNKHEADERSIZE, mPayload.data(), size);
+      // the payload is copied, hence the space can be reused by the producer right away
+      mHeader->tail.store(tail + CHUNKHEADERSIZE + size, std::memory_order_release);
+      if (type == binaryformat::CHUNKLOOKUPS) {
+        if (!mDecoder.decodeLookups(mPayload.data(), size, lookups)) {
+          std::cerr << "ERROR: Corrupted lookups in the step logger stream\n";
+          return false;
+        }
+        continue;
+      }
+      if (type != binaryformat::CHUNKEVENT) {
+        continue;
+      }
+      EventHeader h;
+      if (!mDecoder.decodeEvent(mPayload.data(), size, header ? *header : h, steps, calls, lookups, tracks)) {
+        std::cerr << "ERROR: Corrupted event in the step logger stream\n";
+        return false;
+      }
+      return true;
+    }
+    if (mHeader->closed.load(std::memory_order_acquire)) {
+      // everything published before closing was read
+      if (mHeader->head.load(std::memory_order_acquire) == tail) {
+        return false;
+      }
+      continue;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+unsigned long SharedMemoryStreamReader::nDropped() const
+{
+  return mHeader ? mHeader->dropped.load(std::memory_order_relaxed) : 0;
+}
+} // end namespace o2
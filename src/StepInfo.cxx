@@ -14,6 +14,7 @@
 //  @brief  structures encapsulating information about MC stepping
 
 #include "MCStepLogger/StepInfo.h"
+#include "MCStepLogger/CycleClock.h"
 #include <TArrayI.h>
 #include <TParticle.h>
 #include <TVirtualMC.h>
@@ -21,47 +22,74 @@
 
 #include <TDatabasePDG.h>
 #include <TGeoManager.h>
+#include <TGeoMaterial.h>
 #include <TGeoMedium.h>
 #include <TGeoVolume.h>
+#include <algorithm>
 #include <cassert>
 #include <iostream>
+#include <mutex>
+#include <unordered_set>
 
 ClassImp(o2::StepInfo);
 ClassImp(o2::MagCallInfo);
+ClassImp(o2::MagCallSummary);
+ClassImp(o2::TrackInfo);
+ClassImp(o2::EventHeader);
+ClassImp(o2::LoggerStats);
+ClassImp(o2::FieldStats);
 
 namespace o2
 {
+// the engine might number the volumes differently (e.g. when using its own geometry),
+// hence the geometry lookups are checked once per process against the name given by the engine;
+// the other threads wait for the check such that none of them uses lookups which are switched off afterwards
+bool geometryLookupsMatch(TVirtualMC* mc, int volId)
+{
+  static std::once_flag checked;
+  std::call_once(checked, [mc, volId]() {
+    if (!StepInfo::usegeometrylookups) {
+      return;
+    }
+    auto& geometry = StepInfo::geometrylookups;
+    if (!geometry.hasVolName(volId) || geometry.volidtovolname[volId]->compare(mc->CurrentVolName()) != 0) {
+      std::cerr << "[MCLOGGER:] VOLUME IDS DO NOT MATCH THE GEOMETRY, RESOLVING NAMES FROM THE ENGINE\n";
+      StepInfo::usegeometrylookups = false;
+    }
+  });
+  return StepInfo::usegeometrylookups && StepInfo::geometrylookups.hasVolName(volId);
+}
+
 // construct directly using virtual mc
 StepInfo::StepInfo(TVirtualMC* mc)
 {
   assert(mc);
 
-  // init base time point
-  if (stepcounter == -1) {
-    starttime = std::chrono::high_resolution_clock::now();
-  }
   stepcounter++;
   stepid = stepcounter;
 
   auto stack = mc->GetStack();
 
   trackID = stack->GetCurrentTrackNumber();
-  lookupstructures.insertPDG(trackID, mc->TrackPid());
-
   auto id = mc->CurrentVolID(copyNo);
   volId = id;
-
   auto curtrack = stack->GetCurrentTrack();
-  auto parentID = curtrack->IsPrimary() ? -1 : stack->GetCurrentParentTrackNumber();
-  lookupstructures.insertParent(trackID, parentID);
 
-  // try to resolve the module via external map
-  // keep information in faster vector once looked up
-  auto volname = mc->CurrentVolName();
-  lookupstructures.insertVolName(volId, volname);
+  auto lookupstart = instrumented ? readCycles() : 0;
+  // otherwise PDG and parent are part of the record of the track
+  if (!tracksrecorded) {
+    lookupstructures.insertPDG(trackID, mc->TrackPid());
+    auto parentID = curtrack->IsPrimary() ? -1 : stack->GetCurrentParentTrackNumber();
+    lookupstructures.insertParent(trackID, parentID);
+  }
 
-  if (volnametomodulemap && volnametomodulemap->size() > 0 && volId >= 0) {
-    if (lookupstructures.getModuleAt(volId) == nullptr) {
+  // names known from the geometry are written once per run, the others are only
+  // resolved the first time a volume is seen, try to resolve the module via external map at the same time
+  if (volId >= 0 && !lookupstructures.hasVolName(volId) && !geometryLookupsMatch(mc, volId)) {
+    auto volname = mc->CurrentVolName();
+    lookupstructures.insertVolName(volId, volname);
+
+    if (volnametomodulemap && volnametomodulemap->size() > 0) {
       // lookup in map
       auto iter = volnametomodulemap->find(volname);
       if (iter != volnametomodulemap->end()) {
@@ -69,6 +97,9 @@ StepInfo::StepInfo(TVirtualMC* mc)
       }
     }
   }
+  if (instrumented) {
+    lookupcycles += readCycles() - lookupstart;
+  }
 
   double xd, yd, zd;
   mc->TrackPosition(xd, yd, zd);
@@ -78,31 +109,105 @@ StepInfo::StepInfo(TVirtualMC* mc)
   step = mc->TrackStep();
   maxstep = mc->MaxStep();
   E = curtrack->Energy();
-  auto now = std::chrono::high_resolution_clock::now();
-  // cputimestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(now - starttime).count();
   nsecondaries = mc->NSecondaries();
 
   if (nsecondaries > 0) {
-    secondaryprocesses = new int[nsecondaries];
+    secondaryprocesses = secondaryarena ? secondaryarena->allocate(nsecondaries) : new int[nsecondaries];
     // for the processes
     for (int i = 0; i < nsecondaries; ++i) {
       secondaryprocesses[i] = mc->ProdProcess(i);
     }
   }
 
-  TArrayI procs;
+  // reused such that the engine only reallocates it when the number of processes changes
+  static thread_local TArrayI procs;
   mc->StepProcesses(procs);
   nprocessesactive = procs.GetSize();
+  // the engines do not tell which of them limited the step
+  if (nprocessesactive > 0) {
+    firstprocess = procs[0];
+  }
 
   // was track stopped due to energy limit ??
   stopped = mc->IsTrackStop();
 }
 
-std::chrono::time_point<std::chrono::high_resolution_clock> StepInfo::starttime;
-int StepInfo::stepcounter = -1;
+thread_local int StepInfo::stepcounter = -1;
 std::map<std::string, std::string>* StepInfo::volnametomodulemap = nullptr;
 std::vector<std::string*> StepInfo::volidtomodulevector;
-StepLookups StepInfo::lookupstructures;
+thread_local SecondaryProcessArena* StepInfo::secondaryarena = nullptr;
+thread_local StepLookups StepInfo::lookupstructures;
+thread_local bool StepInfo::tracksrecorded = false;
+StepLookups StepInfo::geometrylookups;
+std::atomic<bool> StepInfo::usegeometrylookups{ false };
+bool StepInfo::instrumented = false;
+thread_local unsigned long long StepInfo::lookupcycles = 0;
+
+int StepInfo::initGeometryLookups()
+{
+  // the engine might come with its own geometry
+  if (!gGeoManager || !gGeoManager->GetListOfUniqueVolumes()) {
+    return 0;
+  }
+  // volume ids are the indices of the unique volumes
+  auto volumes = gGeoManager->GetListOfUniqueVolumes();
+  int nvolumes = 0;
+  for (int i = 0; i < volumes->GetEntriesFast(); ++i) {
+    auto vol = static_cast<TGeoVolume const*>(volumes->UncheckedAt(i));
+    if (!vol) {
+      continue;
+    }
+    auto id = vol->GetNumber();
+    geometrylookups.insertVolName(id, vol->GetName());
+    if (volnametomodulemap) {
+      auto iter = volnametomodulemap->find(vol->GetName());
+      if (iter != volnametomodulemap->end()) {
+        geometrylookups.insertModuleName(id, iter->second);
+      }
+    }
+    // assemblies have no medium
+    if (auto medium = vol->GetMedium()) {
+      geometrylookups.insertMediumName(id, medium->GetName());
+      if (auto material = medium->GetMaterial()) {
+        geometrylookups.insertMaterialName(id, material->GetName());
+      }
+    }
+    nvolumes++;
+  }
+  usegeometrylookups = nvolumes > 0;
+  return nvolumes;
+}
+
+std::string* StepLookups::intern(std::string const& s)
+{
+  // node based, hence pointers to the elements stay valid
+  // shared by all threads
+  static std::unordered_set<std::string> pool;
+  static std::mutex poolmutex;
+  std::lock_guard<std::mutex> lock(poolmutex);
+  return const_cast<std::string*>(&*pool.insert(s).first);
+}
+
+int* SecondaryProcessArena::allocate(int n)
+{
+  while (true) {
+    if (mCurrentBlock < mBlocks.size()) {
+      auto& block = mBlocks[mCurrentBlock];
+      if (mOffset + n <= block.size) {
+        auto p = block.data.get() + mOffset;
+        mOffset += n;
+        return p;
+      }
+      // does not fit, continue in the next block
+      mCurrentBlock++;
+      mOffset = 0;
+      continue;
+    }
+    // large requests get a dedicated block
+    mBlocks.emplace_back(std::max(n, BLOCKSIZE));
+    mHeapAllocations++;
+  }
+}
 
 MagCallInfo::MagCallInfo(TVirtualMC* mc, float ax, float ay, float az, float aBx, float aBy, float aBz)
   : x{ ax }, y{ ay }, z{ az }, B{ std::sqrt(aBx * aBx + aBy * aBy + aBz * aBz) }
@@ -112,5 +217,41 @@ MagCallInfo::MagCallInfo(TVirtualMC* mc, float ax, float ay, float az, float aBx
   stepid = StepInfo::stepcounter;
 }
 
-int MagCallInfo::stepcounter = -1;
+thread_local int MagCallInfo::stepcounter = -1;
+
+void MagCallSummary::add(MagCallInfo const& call)
+{
+  if (ncalls == 0) {
+    stepid = call.stepid;
+    weight = call.weight;
+    Bmin = call.B;
+    Bmax = call.B;
+  }
+  Bmin = std::min(Bmin, call.B);
+  Bmax = std::max(Bmax, call.B);
+  ncalls++;
+  Bmean += (call.B - Bmean) / ncalls;
+  nsmall += call.B < SMALLFIELD;
+  calltime += call.calltime;
+}
+
+void MagCallSummary::summarize(std::vector<MagCallInfo> const& calls, std::vector<MagCallSummary>& summaries)
+{
+  summaries.clear();
+  for (auto& call : calls) {
+    if (summaries.empty() || summaries.back().stepid != call.stepid) {
+      summaries.emplace_back();
+    }
+    summaries.back().add(call);
+  }
+}
+
+void LoggerStats::print(const char* what) const
+{
+  auto ms = [this](unsigned long long cycles) { return 1000. * seconds(cycles); };
+  std::cerr << "[MCLOGGER:] OVERHEAD " << what << ": " << ms(overhead()) << " ms for " << nsteps << " steps and "
+            << nfieldcalls << " field calls (capture " << ms(capture) << " ms, lookups " << ms(lookups)
+            << " ms, growth " << ms(growth) << " ms, field " << ms(field) << " ms, flush " << ms(flush)
+            << " ms) vs. " << ms(stepping) << " ms in Stepping and " << ms(fieldoriginal) << " ms in Field\n";
+}
 }
@@ -0,0 +1,201 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+
+#include "MCStepLogger/StepLoggerIndex.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+#include <map>
+#include <numeric>
+#include <sstream>
+
+ClassImp(o2::EventIndexEntry);
+ClassImp(o2::StepLoggerIndex);
+
+namespace o2
+{
+namespace
+{
+// value of a quantity of an entry, false if there is no such quantity
+bool quantity(EventIndexEntry const& e, std::string const& name, double& value)
+{
+  if (name == "nsteps") {
+    value = e.nsteps;
+  } else if (name == "ncalls") {
+    value = e.ncalls;
+  } else if (name == "ntracks") {
+    value = e.ntracks;
+  } else if (name == "nprimaries") {
+    value = e.nprimaries;
+  } else if (name == "bytes") {
+    value = e.bytes;
+  } else if (name == "walltime") {
+    value = e.walltime;
+  } else if (name == "eventid") {
+    value = e.eventid;
+  } else if (name == "workerid") {
+    value = e.workerid;
+  } else {
+    return false;
+  }
+  return true;
+}
+} // namespace
+
+void EventIndexEntry::add(EventIndexEntry const& other)
+{
+  nsteps += other.nsteps;
+  ncalls += other.ncalls;
+  ntracks += other.ntracks;
+  bytes += other.bytes;
+  walltime += other.walltime;
+  // the primaries are known to every chunk they have steps in
+  nprimaries = std::max(nprimaries, other.nprimaries);
+  chunk = other.chunk;
+  lastchunk = other.lastchunk;
+}
+
+std::vector<IndexedEvent> StepLoggerIndex::events() const
+{
+  std::vector<IndexedEvent> complete;
+  // chunks of events still being transported by other workers may come in between
+  std::map<std::pair<int, int>, IndexedEvent> open;
+  for (auto& e : entries) {
+    auto& event = open[{ e.workerid, e.eventid }];
+    if (event.entries.empty()) {
+      event.summary = e;
+    } else {
+      event.summary.add(e);
+    }
+    event.entries.push_back(e.entry);
+    if (e.lastchunk) {
+      complete.push_back(std::move(event));
+      open.erase({ e.workerid, e.eventid });
+    }
+  }
+  return complete;
+}
+
+bool EventSelection::addRanges(const std::string& spec)
+{
+  std::stringstream stream(spec);
+  std::string range;
+  while (std::getline(stream, range, ',')) {
+    if (range.empty()) {
+      continue;
+    }
+    char* end = nullptr;
+    long first = std::strtol(range.c_str(), &end, 10);
+    long last = first;
+    if (end == range.c_str() || first < 0) {
+      return false;
+    }
+    if (*end == '-') {
+      // open end
+      last = *(end + 1) == '\0' ? std::numeric_limits<long>::max() : std::strtol(end + 1, &end, 10);
+    }
+    if (*end != '\0' && last != std::numeric_limits<long>::max()) {
+      return false;
+    }
+    if (last < first) {
+      return false;
+    }
+    mRanges.emplace_back(first, last);
+  }
+  return true;
+}
+
+bool EventSelection::addCut(const std::string& spec)
+{
+  auto position = spec.find_first_of("<>=!");
+  if (position == std::string::npos || position == 0) {
+    return false;
+  }
+  Cut cut;
+  cut.quantity = spec.substr(0, position);
+  auto length = position + 1 < spec.size() && spec[position + 1] == '=' ? 2 : 1;
+  cut.op = spec.substr(position, length);
+  if (cut.op == "=" || cut.op == "!") {
+    return false;
+  }
+  auto valueString = spec.substr(position + length);
+  char* end = nullptr;
+  cut.value = std::strtod(valueString.c_str(), &end);
+  double test;
+  if (valueString.empty() || *end != '\0' || !quantity(EventIndexEntry(), cut.quantity, test)) {
+    return false;
+  }
+  mCuts.push_back(cut);
+  return true;
+}
+
+bool EventSelection::accept(int number, EventIndexEntry const& event) const
+{
+  if (!mRanges.empty() && std::none_of(mRanges.begin(), mRanges.end(), [number](auto const& r) { return number >= r.first && number <= r.second; })) {
+    return false;
+  }
+  for (auto& cut : mCuts) {
+    double value = 0.;
+    quantity(event, cut.quantity, value);
+    bool pass = (cut.op == "<" && value < cut.value) || (cut.op == "<=" && value <= cut.value) ||
+                (cut.op == ">" && value > cut.value) || (cut.op == ">=" && value >= cut.value) ||
+                (cut.op == "==" && value == cut.value) || (cut.op == "!=" && value != cut.value);
+    if (!pass) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::vector<IndexedEvent> EventSelection::select(const StepLoggerIndex& index) const
+{
+  auto events = index.events();
+  std::vector<IndexedEvent> selected;
+  for (int i = 0; i < events.size(); ++i) {
+    if (accept(i, events[i].summary)) {
+      selected.push_back(std::move(events[i]));
+    }
+  }
+  return selected;
+}
+
+std::vector<long> EventSelection::selectEntries(const StepLoggerIndex& index) const
+{
+  std::vector<long> entries;
+  for (auto& event : select(index)) {
+    entries.insert(entries.end(), event.entries.begin(), event.entries.end());
+  }
+  // the chunks of the selected events are read in the order they were written
+  std::sort(entries.begin(), entries.end());
+  return entries;
+}
+
+std::vector<std::vector<long>> partitionEvents(const std::vector<IndexedEvent>& events, int n)
+{
+  std::vector<std::vector<long>> partitions(std::max(n, 1));
+  std::vector<long> load(partitions.size(), 0);
+  // largest events first, each to the partition with the fewest steps so far;
+  // events of an index built without step counts are weighted equally
+  auto weight = [&events](std::size_t i) { return std::max(1L, events[i].summary.nsteps); };
+  std::vector<std::size_t> order(events.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&weight](std::size_t a, std::size_t b) { return weight(a) > weight(b); });
+  for (auto i : order) {
+    auto p = std::min_element(load.begin(), load.end()) - load.begin();
+    partitions[p].insert(partitions[p].end(), events[i].entries.begin(), events[i].entries.end());
+    load[p] += weight(i);
+  }
+  for (auto& entries : partitions) {
+    std::sort(entries.begin(), entries.end());
+  }
+  return partitions;
+}
+} // end namespace o2
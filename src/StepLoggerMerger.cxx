@@ -0,0 +1,178 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+
+#include "MCStepLogger/StepLoggerMerger.h"
+#include "MCStepLogger/StepInfo.h"
+#include "MCStepLogger/MetaInfo.h"
+#include "MCStepLogger/StepLoggerIndex.h"
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+
+#include "TFile.h"
+#include "TTree.h"
+#include "TBranch.h"
+
+namespace o2
+{
+namespace
+{
+// number of volumes other names differently than lookups
+int countNameConflicts(StepLookups const& lookups, StepLookups const& other)
+{
+  int conflicts = 0;
+  auto count = [&conflicts](std::vector<std::string*> const& names, std::vector<std::string*> const& otherNames) {
+    for (int i = 0; i < std::min(names.size(), otherNames.size()); ++i) {
+      if (names[i] && otherNames[i] && names[i]->compare(*otherNames[i]) != 0) {
+        conflicts++;
+      }
+    }
+  };
+  count(lookups.volidtovolname, other.volidtovolname);
+  count(lookups.volidtomodule, other.volidtomodule);
+  count(lookups.volidtomedium, other.volidtomedium);
+  count(lookups.volidtomaterial, other.volidtomaterial);
+  return conflicts;
+}
+} // namespace
+
+bool mergeStepLoggerFiles(const std::vector<std::string>& inputFiles, const std::string& outputFile)
+{
+  const char* treename = mcstepanalysis::defaults::defaultStepLoggerTTreeName.c_str();
+  TFile output(outputFile.c_str(), "RECREATE");
+  if (output.IsZombie()) {
+    std::cerr << "ERROR: Cannot create " << outputFile << "\n";
+    return false;
+  }
+  TTree* mergedTree = nullptr;
+  // branches of the first input, all others need to have the same
+  std::vector<std::string> branchNames;
+  StepLookups runLookups;
+  // headers of all merged events, the branch is added once all baskets are copied
+  std::vector<EventHeader> headers;
+  // the index is only kept if all inputs have one
+  StepLoggerIndex mergedIndex;
+  bool isIndexed = true;
+  int eventOffset = 0;
+  int nMerged = 0;
+
+  for (auto& path : inputFiles) {
+    std::unique_ptr<TFile> input(TFile::Open(path.c_str(), "READ"));
+    TTree* tree = nullptr;
+    if (input && !input->IsZombie()) {
+      input->GetObject(treename, tree);
+    }
+    if (!tree) {
+      std::cerr << "WARNING: No " << treename << " in " << path << ", skipped\n";
+      continue;
+    }
+    std::vector<std::string> names;
+    TIter next(tree->GetListOfBranches());
+    while (auto branch = static_cast<TBranch*>(next())) {
+      if (std::string(branch->GetName()) != "Header") {
+        names.push_back(branch->GetName());
+      }
+    }
+    if (mergedTree && names != branchNames) {
+      std::cerr << "WARNING: Branches of " << path << " differ from those of " << inputFiles.front() << ", skipped\n";
+      continue;
+    }
+
+    StepLoggerIndex* index = nullptr;
+    input->GetObject("StepLoggerIndex", index);
+    isIndexed = isIndexed && index;
+    if (isIndexed) {
+      for (auto e : index->entries) {
+        e.entry += headers.size();
+        e.eventid += eventOffset;
+        mergedIndex.entries.push_back(e);
+      }
+    }
+    delete index;
+
+    // event ids are shifted behind those of the previous inputs, chunks of an event keep sharing their id;
+    // older files without header have one complete event per entry
+    const bool hasHeader = tree->GetBranch("Header") != nullptr;
+    EventHeader* header = nullptr;
+    if (hasHeader) {
+      tree->SetBranchStatus("*", false);
+      tree->SetBranchStatus("Header", true);
+      tree->SetBranchAddress("Header", &header);
+    }
+    int maxEventId = eventOffset - 1;
+    for (Long64_t entry = 0; entry < tree->GetEntries(); ++entry) {
+      EventHeader h;
+      if (hasHeader) {
+        tree->GetEntry(entry);
+        h = *header;
+      } else {
+        h.eventid = entry;
+      }
+      h.eventid += eventOffset;
+      maxEventId = std::max(maxEventId, h.eventid);
+      headers.push_back(h);
+    }
+    eventOffset = maxEventId + 1;
+    if (hasHeader) {
+      tree->ResetBranchAddresses();
+      tree->SetBranchStatus("*", true);
+      tree->SetBranchStatus("Header", false);
+    }
+
+    // names of all volumes are kept once, inputs of the same geometry agree on them
+    StepLookups* lookups = nullptr;
+    input->GetObject("RunLookups", lookups);
+    if (lookups) {
+      if (auto conflicts = countNameConflicts(runLookups, *lookups)) {
+        std::cerr << "WARNING: " << conflicts << " volume names of " << path
+                  << " differ from those of previous inputs, were they simulated with the same geometry?\n";
+      }
+      runLookups.mergeNames(*lookups);
+      delete lookups;
+    }
+
+    // all other branches are copied basket by basket
+    output.cd();
+    if (!mergedTree) {
+      mergedTree = tree->CloneTree(0);
+      mergedTree->SetDirectory(&output);
+      branchNames = names;
+    }
+    mergedTree->CopyEntries(tree, -1, "fast");
+    std::cerr << "INFO: Merged " << tree->GetEntries() << " entries of " << path << "\n";
+    nMerged++;
+  }
+
+  if (!mergedTree) {
+    std::cerr << "ERROR: Nothing to merge\n";
+    output.Close();
+    return false;
+  }
+  output.cd();
+  EventHeader current;
+  EventHeader* currentAddress = &current;
+  auto headerBranch = mergedTree->Branch("Header", &currentAddress);
+  for (auto& h : headers) {
+    current = h;
+    headerBranch->Fill();
+  }
+  mergedTree->Write("", TObject::kOverwrite);
+  output.WriteObject(&runLookups, "RunLookups");
+  if (isIndexed) {
+    output.WriteObject(&mergedIndex, "StepLoggerIndex");
+  } else {
+    std::cerr << "WARNING: Not all files have a StepLoggerIndex, the merged file has none\n";
+  }
+  output.Close();
+  std::cerr << "INFO: " << nMerged << " files with " << headers.size() << " entries merged into " << outputFile << "\n";
+  return true;
+}
+} // end namespace o2
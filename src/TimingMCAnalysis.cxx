@@ -0,0 +1,144 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+
+#include <iostream>
+
+#include <TMCProcess.h>
+
+#include "MCStepLogger/TimingMCAnalysis.h"
+
+ClassImp(o2::mcstepanalysis::TimingMCAnalysis);
+
+using namespace o2::mcstepanalysis;
+
+TimingMCAnalysis::TimingMCAnalysis()
+  : MCAnalysis("TimingMCAnalysis")
+{
+}
+
+void TimingMCAnalysis::initialize()
+{
+  // number of events
+  histNEvents = getHistogram<TH1D>("nEvents", 1, 0., 1.);
+  // time per event
+  histTimePerEvent = getHistogram<TH1D>("timePerEvent", 1, 0., 1.);
+  // time per volume averaged over number of events
+  histTimePerVolPerEvent = getHistogram<TH1D>("timePerVolPerEvent", 1, 0., 1.);
+  // time per module averaged over number of events
+  histTimePerModPerEvent = getHistogram<TH1D>("timePerModPerEvent", 1, 0., 1.);
+  // time per PDG ID averaged over number of events
+  histTimePerPDGPerEvent = getHistogram<TH1D>("timePerPDGPerEvent", 1, 0., 1.);
+  // time per first active process of the step averaged over number of events
+  histTimePerProcessPerEvent = getHistogram<TH1D>("timePerProcessPerEvent", 1, 0., 1.);
+  // mean time per step in a volume
+  histMeanTimePerStepPerVol = getHistogram<TH1D>("meanTimePerStepPerVol", 1, 0., 1.);
+  // time in field calls per event
+  histFieldTimePerEvent = getHistogram<TH1D>("fieldTimePerEvent", 1, 0., 1.);
+  // time in field calls per volume averaged over number of events
+  histFieldTimePerVolPerEvent = getHistogram<TH1D>("fieldTimePerVolPerEvent", 1, 0., 1.);
+  // time in field calls per module averaged over number of events
+  histFieldTimePerModPerEvent = getHistogram<TH1D>("fieldTimePerModPerEvent", 1, 0., 1.);
+  // helper counting the steps per volume to derive the mean time per step
+  nStepsPerVol.clear();
+}
+
+void TimingMCAnalysis::analyze(const std::vector<StepInfo>* const steps, const std::vector<MagCallInfo>* const magCalls)
+{
+  histNEvents->Fill(0.5);
+  // to store the volume name
+  std::string volName = "";
+  // to store the module name
+  std::string modName = "";
+  // to store particle ID
+  int pdgId = 0;
+  // total time of this event
+  double timePerEvent = 0.;
+
+  for (const auto& step : *steps) {
+    // time spent for this step, scaled in case only a fraction of steps was logged
+    const double time = step.weight * step.cputime;
+    timePerEvent += time;
+
+    mAnalysisManager->getLookupVolName(step.volId, volName);
+    mAnalysisManager->getLookupModName(step.volId, modName);
+    mAnalysisManager->getLookupPDG(step.trackID, pdgId);
+
+    histTimePerVolPerEvent->Fill(volName.c_str(), time);
+    histTimePerModPerEvent->Fill(modName.c_str(), time);
+    histTimePerPDGPerEvent->Fill(std::to_string(pdgId).c_str(), time);
+    if (step.firstprocess >= 0 && step.firstprocess < kMaxMCProcess) {
+      histTimePerProcessPerEvent->Fill(TMCProcessName[step.firstprocess], time);
+    } else {
+      histTimePerProcessPerEvent->Fill("UNKNOWNPROCESS", time);
+    }
+    histMeanTimePerStepPerVol->Fill(volName.c_str(), time);
+    nStepsPerVol[volName] += step.weight;
+    stepIdToVolId[step.stepid] = step.volId;
+  }
+  histTimePerEvent->Fill(0.5, timePerEvent);
+
+  // field calls are attributed to the last step before them
+  double fieldTimePerEvent = 0.;
+  for (const auto& summary : *mAnalysisManager->getCallSummaries()) {
+    const double time = summary.weight * summary.calltime;
+    if (time == 0.) {
+      continue;
+    }
+    fieldTimePerEvent += time;
+    auto volId = stepIdToVolId.find(summary.stepid);
+    if (volId == stepIdToVolId.end()) {
+      histFieldTimePerVolPerEvent->Fill("UNKNOWNVOLUME", time);
+      histFieldTimePerModPerEvent->Fill("UNKNOWNMODULE", time);
+      continue;
+    }
+    mAnalysisManager->getLookupVolName(volId->second, volName);
+    mAnalysisManager->getLookupModName(volId->second, modName);
+    histFieldTimePerVolPerEvent->Fill(volName.c_str(), time);
+    histFieldTimePerModPerEvent->Fill(modName.c_str(), time);
+  }
+  histFieldTimePerEvent->Fill(0.5, fieldTimePerEvent);
+  stepIdToVolId.clear();
+}
+
+void TimingMCAnalysis::merge(const MCAnalysis& other)
+{
+  // the mapping of step ids is only needed within an event
+  for (auto& n : static_cast<const TimingMCAnalysis&>(other).nStepsPerVol) {
+    nStepsPerVol[n.first] += n.second;
+  }
+}
+
+void TimingMCAnalysis::finalize()
+{
+  if (histTimePerEvent->GetBinContent(1) <= 0.) {
+    std::cerr << "WARNING: No timing information found, the MCStepLogger needs to be run with MCSTEPLOG_TIMING=1\n";
+  }
+  // the mean time per step is derived from the accumulated time
+  int nVolBins = histMeanTimePerStepPerVol->GetNbinsX();
+  for (int i = 1; i < nVolBins + 1; i++) {
+    auto nSteps = nStepsPerVol.find(histMeanTimePerStepPerVol->GetXaxis()->GetBinLabel(i));
+    if (nSteps != nStepsPerVol.end() && nSteps->second > 0.) {
+      histMeanTimePerStepPerVol->SetBinContent(i, histMeanTimePerStepPerVol->GetBinContent(i) / nSteps->second);
+    }
+  }
+  // normalise over all events such that all contributions add up to the time per event
+  const double nEvents = histNEvents->GetEntries();
+  if (nEvents <= 0.) {
+    return;
+  }
+  histTimePerEvent->Scale(1. / nEvents);
+  histTimePerVolPerEvent->Scale(1. / nEvents);
+  histTimePerModPerEvent->Scale(1. / nEvents);
+  histTimePerPDGPerEvent->Scale(1. / nEvents);
+  histTimePerProcessPerEvent->Scale(1. / nEvents);
+  histFieldTimePerEvent->Scale(1. / nEvents);
+  histFieldTimePerVolPerEvent->Scale(1. / nEvents);
+  histFieldTimePerModPerEvent->Scale(1. / nEvents);
+}
@@ -0,0 +1,285 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+
+#include "MCStepLogger/TreeWriteSettings.h"
+#include "MCStepLogger/StepInfo.h"
+#include "MCStepLogger/BinaryStepFormat.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <set>
+
+#include "TSystem.h"
+
+namespace o2
+{
+namespace
+{
+// algorithm ids as used by ROOT, a setting is 100 * algorithm + level
+struct CompressionAlgorithm {
+  const char* name;
+  int id;
+  int defaultLevel;
+};
+const CompressionAlgorithm algorithms[] = { { "zlib", 1, 1 }, { "lzma", 2, 5 }, { "lz4", 4, 4 }, { "zstd", 5, 5 } };
+
+// time to read all entries of the event branches of a tree written by the benchmark
+double readTree(const std::string& path)
+{
+  TFile file(path.c_str(), "READ");
+  TTree* tree = nullptr;
+  file.GetObject("StepLoggerTree", tree);
+  if (!tree) {
+    return 0.;
+  }
+  EventHeader* header = nullptr;
+  std::vector<StepInfo>* steps = nullptr;
+  std::vector<MagCallInfo>* calls = nullptr;
+  std::vector<MagCallSummary>* callsummaries = nullptr;
+  StepLookups* lookups = nullptr;
+  std::vector<TrackInfo>* tracks = nullptr;
+  auto connect = [tree](const char* name, auto** address) {
+    if (tree->GetBranch(name)) {
+      tree->SetBranchAddress(name, address);
+    }
+  };
+  connect("Header", &header);
+  connect("Steps", &steps);
+  connect("Calls", &calls);
+  connect("CallSummaries", &callsummaries);
+  connect("Lookups", &lookups);
+  connect("Tracks", &tracks);
+  auto start = std::chrono::steady_clock::now();
+  for (long entry = 0; entry < tree->GetEntries(); ++entry) {
+    tree->GetEntry(entry);
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  tree->ResetBranchAddresses();
+  delete header;
+  delete steps;
+  delete calls;
+  delete callsummaries;
+  delete lookups;
+  delete tracks;
+  return elapsed.count();
+}
+
+// time to decode all events of a binary file
+double readBinary(const std::string& path)
+{
+  auto start = std::chrono::steady_clock::now();
+  BinaryStepReader reader;
+  if (!reader.open(path)) {
+    return 0.;
+  }
+  EventHeader header;
+  std::vector<StepInfo> steps;
+  std::vector<MagCallInfo> calls;
+  StepLookups lookups;
+  std::vector<TrackInfo> tracks;
+  while (reader.readNextEvent(steps, calls, lookups, &header, &tracks)) {
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+double fileSize(const std::string& path)
+{
+  FileStat_t stat;
+  gSystem->GetPathInfo(path.c_str(), stat);
+  return stat.fSize;
+}
+} // namespace
+
+bool TreeWriteSettings::setCompression(const std::string& spec)
+{
+  auto colon = spec.find(':');
+  auto name = spec.substr(0, colon);
+  const CompressionAlgorithm* algorithm = nullptr;
+  for (auto& a : algorithms) {
+    if (name == a.name) {
+      algorithm = &a;
+    }
+  }
+  if (!algorithm && name != "none") {
+    return false;
+  }
+  long level = -1;
+  if (colon != std::string::npos) {
+    const char* start = spec.c_str() + colon + 1;
+    char* end = nullptr;
+    level = std::strtol(start, &end, 10);
+    if (end == start || *end != '\0' || level < 0 || level > 9) {
+      return false;
+    }
+  }
+  if (!algorithm || level == 0) {
+    compression = 0;
+    return true;
+  }
+  compression = 100 * algorithm->id + (level < 0 ? algorithm->defaultLevel : level);
+  return true;
+}
+
+std::string TreeWriteSettings::describe() const
+{
+  std::string description = "default";
+  if (compression == 0) {
+    description = "none";
+  } else if (compression > 0) {
+    for (auto& algorithm : algorithms) {
+      if (compression / 100 == algorithm.id) {
+        description = std::string(algorithm.name) + ":" + std::to_string(compression % 100);
+      }
+    }
+  }
+  return description + " basket " + std::to_string(basketsize) + " split " + std::to_string(splitlevel);
+}
+
+void TreeWriteSettings::apply(TFile* file) const
+{
+  if (compression >= 0) {
+    file->SetCompressionSettings(compression);
+  }
+}
+
+bool benchmarkTreeWriting(const std::string& inputFile, const std::vector<TreeWriteSettings>& settings,
+                          const std::string& outputDir, int nEvents, bool withBinary)
+{
+  TFile input(inputFile.c_str(), "READ");
+  TTree* inputTree = nullptr;
+  if (!input.IsZombie()) {
+    input.GetObject("StepLoggerTree", inputTree);
+  }
+  if (!inputTree) {
+    std::cerr << "ERROR: Cannot find the StepLoggerTree in " << inputFile << "\n";
+    return false;
+  }
+  // the event branches are rewritten, the logger statistics are left out
+  EventHeader* header = nullptr;
+  std::vector<StepInfo>* steps = nullptr;
+  std::vector<MagCallInfo>* calls = nullptr;
+  std::vector<MagCallSummary>* callsummaries = nullptr;
+  StepLookups* lookups = nullptr;
+  std::vector<TrackInfo>* tracks = nullptr;
+  auto connect = [inputTree](const char* name, auto** address) {
+    if (!inputTree->GetBranch(name)) {
+      return false;
+    }
+    inputTree->SetBranchAddress(name, address);
+    return true;
+  };
+  const bool hasHeader = connect("Header", &header);
+  const bool hasCalls = connect("Calls", &calls);
+  const bool hasCallSummaries = connect("CallSummaries", &callsummaries);
+  const bool hasTracks = connect("Tracks", &tracks);
+  if (!connect("Steps", &steps) || !connect("Lookups", &lookups)) {
+    std::cerr << "ERROR: Cannot find required branches in " << inputFile << "\n";
+    return false;
+  }
+  long n = inputTree->GetEntries();
+  if (nEvents > 0 && nEvents < n) {
+    n = nEvents;
+  }
+  // names written once per run, events only carry the others
+  StepLookups* runLookups = nullptr;
+  input.GetObject("RunLookups", runLookups);
+  std::vector<MagCallInfo> noCalls;
+  // each compression is only written once in the binary format
+  std::set<int> binaryCompressions;
+
+  // all throughputs are given w.r.t. the uncompressed size of the tree, also for the binary format
+  constexpr double MB = 1 << 20;
+  auto print = [](std::string const& description, double raw, double size, double write, double read) {
+    std::printf("%-36s %12.2f %12.2f %12.2f %12.2f %8.2f\n", description.c_str(), raw / MB, size / MB,
+                write > 0. ? raw / MB / write : 0., read > 0. ? raw / MB / read : 0., size > 0. ? raw / size : 0.);
+  };
+  std::printf("%-36s %12s %12s %12s %12s %8s\n", "settings", "raw [MB]", "file [MB]", "write [MB/s]", "read [MB/s]",
+              "ratio");
+  for (std::size_t i = 0; i < settings.size(); ++i) {
+    auto& s = settings[i];
+    const std::string path = outputDir + "/MCStepLoggerBenchmark_" + std::to_string(i) + ".root";
+    TFile output(path.c_str(), "RECREATE");
+    s.apply(&output);
+    auto tree = new TTree("StepLoggerTree", "Tree container information from MC step logger");
+    if (hasHeader) {
+      s.branch(tree, "Header", &header);
+    }
+    s.branch(tree, "Steps", &steps);
+    if (hasCalls) {
+      s.branch(tree, "Calls", &calls);
+    }
+    if (hasCallSummaries) {
+      s.branch(tree, "CallSummaries", &callsummaries);
+    }
+    s.branch(tree, "Lookups", &lookups);
+    if (hasTracks) {
+      s.branch(tree, "Tracks", &tracks);
+    }
+    // only filling and writing is timed, reading the input is not
+    std::chrono::duration<double> elapsed{ 0. };
+    for (long entry = 0; entry < n; ++entry) {
+      inputTree->GetEntry(entry);
+      auto start = std::chrono::steady_clock::now();
+      tree->Fill();
+      elapsed += std::chrono::steady_clock::now() - start;
+    }
+    auto start = std::chrono::steady_clock::now();
+    output.cd();
+    tree->Write("", TObject::kOverwrite);
+    const double raw = tree->GetTotBytes();
+    output.Close();
+    elapsed += std::chrono::steady_clock::now() - start;
+    print(s.describe(), raw, fileSize(path), elapsed.count(), readTree(path));
+    gSystem->Unlink(path.c_str());
+
+    if (!withBinary || !binaryCompressions.insert(s.compression).second) {
+      continue;
+    }
+    // the same events in the binary format, which has no aggregated field calls
+    TreeWriteSettings binary;
+    binary.compression = s.compression < 0 ? binaryformat::DEFAULTCOMPRESSION : s.compression;
+    const std::string binaryPath = outputDir + "/MCStepLoggerBenchmark_" + std::to_string(i) + ".bin";
+    BinaryStepWriter writer;
+    start = std::chrono::steady_clock::now();
+    if (!writer.open(binaryPath, false, binary.compression)) {
+      continue;
+    }
+    if (runLookups) {
+      writer.writeLookups(*runLookups);
+    }
+    elapsed = std::chrono::steady_clock::now() - start;
+    for (long entry = 0; entry < n; ++entry) {
+      inputTree->GetEntry(entry);
+      EventHeader eventHeader;
+      if (hasHeader) {
+        eventHeader = *header;
+      } else {
+        eventHeader.eventid = entry;
+      }
+      start = std::chrono::steady_clock::now();
+      writer.writeEvent(eventHeader, *steps, hasCalls ? *calls : noCalls, *lookups, hasTracks ? tracks : nullptr);
+      elapsed += std::chrono::steady_clock::now() - start;
+    }
+    start = std::chrono::steady_clock::now();
+    writer.close();
+    elapsed += std::chrono::steady_clock::now() - start;
+    auto description = binary.describe();
+    print("binary " + description.substr(0, description.find(' ')), raw, fileSize(binaryPath), elapsed.count(),
+          readBinary(binaryPath));
+    gSystem->Unlink(binaryPath.c_str());
+  }
+  delete runLookups;
+  return true;
+}
+} // end namespace o2
@@ -22,12 +22,15 @@
 #include "MCStepLogger/MCAnalysisManager.h"
 #include "MCStepLogger/MCAnalysisFileWrapper.h"
 #include "MCStepLogger/BasicMCAnalysis.h"
+#include "MCStepLogger/TimingMCAnalysis.h"
+#include "MCStepLogger/TreeWriteSettings.h"
+#include "MCStepLogger/StepLoggerMerger.h"
 
 using namespace o2::mcstepanalysis;
 
 namespace bpo = boost::program_options;
 
-std::vector<std::string> availableCommands = { "analyze", "checkFile" };
+std::vector<std::string> availableCommands = { "analyze", "stream", "checkFile", "benchmark", "merge" };
 
 // print help message
 void helpMessage(const bpo::options_description& desc)
@@ -64,8 +67,8 @@ int analyze(const bpo::variables_map& vm, std::string& errorMessage)
     errorMessage += "Analysis names but no analysis directory passed.\n";
   }
   //////////////////////////////////////////////////////////////////////////////////////////////
-  // now the check for ROOT files
-  if (!vm.count("root-file") && !vm.count("list-analyses")) {
+  // now the check for ROOT files, not needed when analysing a stream
+  if (!vm.count("root-file") && !vm.count("shm-name") && !vm.count("list-analyses")) {
     errorMessage += "Need ROOT file from MCStepLogger.\n";
   }
   //////////////////////////////////////////////////////////////////////////////////////////////
@@ -78,6 +81,19 @@ int analyze(const bpo::variables_map& vm, std::string& errorMessage)
   if (!vm.count("label") && !vm.count("list-analyses")) {
     errorMessage += "Need a label for this analysis.\n";
   }
+  //////////////////////////////////////////////////////////////////////////////////////////////
+  // events selected from the index of the file
+  o2::EventSelection selection;
+  if (vm.count("events") && !selection.addRanges(vm["events"].as<std::string>())) {
+    errorMessage += "Cannot parse event ranges " + vm["events"].as<std::string>() + "\n";
+  }
+  if (vm.count("select")) {
+    for (auto& cut : vm["select"].as<std::vector<std::string>>()) {
+      if (!selection.addCut(cut)) {
+        errorMessage += "Cannot parse selection " + cut + "\n";
+      }
+    }
+  }
   if (!errorMessage.empty()) {
     return 1;
   }
@@ -91,6 +107,8 @@ int analyze(const bpo::variables_map& vm, std::string& errorMessage)
   }
   // create basic analysis by default, is registered automaticallyt to AnalysisManager
   new BasicMCAnalysis();
+  // time per volume, module, ... (only filled if the steps were logged with timing)
+  new TimingMCAnalysis();
   //////////////////////////////////////////////////////////////////////////////////////////////
   // List analyses and quit. This has to be done here after analyses are read from analysis-dir
   // the first time the AnalysisManager is needed
@@ -102,7 +120,15 @@ int analyze(const bpo::variables_map& vm, std::string& errorMessage)
   //////////////////////////////////////////////////////////////////////////////////////////////
   // set a label and the input file from MCStepLogger
   anamgr.setLabel(vm["label"].as<std::string>());
-  anamgr.setInputFilepath(vm["root-file"].as<std::string>());
+  if (vm.count("shm-name")) {
+    anamgr.setInputStream(vm["shm-name"].as<std::string>());
+  } else {
+    anamgr.setInputFilepath(vm["root-file"].as<std::string>());
+  }
+  anamgr.setEventSelection(selection);
+  if (vm.count("jobs")) {
+    anamgr.setNWorkers(vm["jobs"].as<int>());
+  }
   // if ready, run
   if (!anamgr.checkReadiness()) {
     return 1;
@@ -140,15 +166,77 @@ int checkFile(const bpo::variables_map& vm, std::string& errorMessage)
   return 1;
 }
 
+// rewrite a MCStepLogger file with different compression, basket size and split level settings
+int benchmark(const bpo::variables_map& vm, std::string& errorMessage)
+{
+  if (!vm.count("root-file")) {
+    errorMessage += "ROOT file from MCStepLogger required.\n";
+  }
+  // every combination of the given settings is tried
+  std::vector<o2::TreeWriteSettings> settings;
+  for (auto& compression : vm["compression"].as<std::vector<std::string>>()) {
+    for (auto basketsize : vm["basket-size"].as<std::vector<int>>()) {
+      for (auto splitlevel : vm["split-level"].as<std::vector<int>>()) {
+        o2::TreeWriteSettings s;
+        if (!s.setCompression(compression)) {
+          errorMessage += "Unknown compression " + compression + "\n";
+        }
+        s.basketsize = basketsize;
+        s.splitlevel = splitlevel;
+        settings.push_back(s);
+      }
+    }
+  }
+  if (!errorMessage.empty()) {
+    return 1;
+  }
+  std::cerr << "INFO: Rewrite " << vm["root-file"].as<std::string>() << " with " << settings.size() << " settings\n";
+  if (!o2::benchmarkTreeWriting(vm["root-file"].as<std::string>(), settings, vm["output-dir"].as<std::string>(),
+                                vm["number-events"].as<int>(), vm.count("binary") > 0)) {
+    errorMessage += "Cannot read the MCStepLogger file.\n";
+    return 1;
+  }
+  return 0;
+}
+
+// merge the output files of several MCStepLogger jobs
+int merge(const bpo::variables_map& vm, std::string& errorMessage)
+{
+  if (!vm.count("root-files")) {
+    errorMessage += "ROOT files from MCStepLogger required.\n";
+  }
+  if (!vm.count("output-file")) {
+    errorMessage += "Need an output file.\n";
+  }
+  if (!errorMessage.empty()) {
+    return 1;
+  }
+  if (!o2::mergeStepLoggerFiles(vm["root-files"].as<std::vector<std::string>>(), vm["output-file"].as<std::string>())) {
+    errorMessage += "None of the files could be merged.\n";
+    return 1;
+  }
+  return 0;
+}
+
 // Initialize everything for the final run depending on the command
 void initializeForRun(const std::string& cmd, bpo::options_description& cmdOptionsDescriptions, std::function<int(const bpo::variables_map&, std::string&)>& cmdFunction)
 {
   if (cmd == "analyze") {
-    cmdOptionsDescriptions.add_options()("help,h", "show this help message and exit")("analyses,a", bpo::value<std::vector<std::string>>()->multitoken(), "analyses to be run")("analysis-dir,d", bpo::value<std::string>(), "directory containing analysis macros (required, if --analyses is used)")("list-analyses,s", "list available analyses and exit")("root-file,f", bpo::value<std::string>(), "ROOT file from MCStepLogger to be analysed (required)")("label,l", bpo::value<std::string>(), "custom label for the analysis (required)")("output-dir,o", bpo::value<std::string>(), "output directory for analyses (required)")("number-events,n", bpo::value<int>()->default_value(-1), "only analyse a certain number of events");
+    cmdOptionsDescriptions.add_options()("help,h", "show this help message and exit")("analyses,a", bpo::value<std::vector<std::string>>()->multitoken(), "analyses to be run")("analysis-dir,d", bpo::value<std::string>(), "directory containing analysis macros (required, if --analyses is used)")("list-analyses,s", "list available analyses and exit")("root-file,f", bpo::value<std::string>(), "ROOT file from MCStepLogger to be analysed (required)")("label,l", bpo::value<std::string>(), "custom label for the analysis (required)")("output-dir,o", bpo::value<std::string>(), "output directory for analyses (required)")("number-events,n", bpo::value<int>()->default_value(-1), "only analyse a certain number of events")("events,e", bpo::value<std::string>(), "only analyse these events, e.g. 0-9,20,100- (needs the StepLoggerIndex)")("select,x", bpo::value<std::vector<std::string>>()->multitoken(), "only analyse events passing these cuts, e.g. nsteps>1e6 (needs the StepLoggerIndex)")("jobs,j", bpo::value<int>()->default_value(1), "number of threads the events are distributed over");
+    cmdFunction = analyze;
+  } else if (cmd == "stream") {
+    // same as analyze but events are received live from a running MCStepLogger with MCSTEPLOG_OUTPUT=shm
+    cmdOptionsDescriptions.add_options()("help,h", "show this help message and exit")("analyses,a", bpo::value<std::vector<std::string>>()->multitoken(), "analyses to be run")("analysis-dir,d", bpo::value<std::string>(), "directory containing analysis macros (required, if --analyses is used)")("list-analyses,s", "list available analyses and exit")("shm-name,m", bpo::value<std::string>()->default_value("/MCStepLogger"), "name of the shared memory the MCStepLogger streams to (MCSTEPLOG_SHM_NAME)")("label,l", bpo::value<std::string>(), "custom label for the analysis (required)")("output-dir,o", bpo::value<std::string>(), "output directory for analyses (required)")("number-events,n", bpo::value<int>()->default_value(-1), "only analyse a certain number of events");
     cmdFunction = analyze;
   } else if (cmd == "checkFile") {
     cmdOptionsDescriptions.add_options()("help,h", "show this help message and exit")("root-file,f", bpo::value<std::string>(), "ROOT file to be checked");
     cmdFunction = checkFile;
+  } else if (cmd == "benchmark") {
+    cmdOptionsDescriptions.add_options()("help,h", "show this help message and exit")("root-file,f", bpo::value<std::string>(), "ROOT file from MCStepLogger to be rewritten (required)")("compression,c", bpo::value<std::vector<std::string>>()->multitoken()->default_value({ "zlib:1", "lz4:4", "zstd:5", "lzma:5" }, "zlib:1 lz4:4 zstd:5 lzma:5"), "compression settings <algorithm>[:<level>] (zlib, lzma, lz4, zstd, none)")("basket-size,b", bpo::value<std::vector<int>>()->multitoken()->default_value({ 32000 }, "32000"), "basket sizes in bytes")("split-level,s", bpo::value<std::vector<int>>()->multitoken()->default_value({ 99 }, "99"), "split levels")("output-dir,o", bpo::value<std::string>()->default_value("."), "directory for the temporary files")("number-events,n", bpo::value<int>()->default_value(-1), "only rewrite a certain number of events")("binary", "also write the binary format with each compression");
+    cmdFunction = benchmark;
+  } else if (cmd == "merge") {
+    cmdOptionsDescriptions.add_options()("help,h", "show this help message and exit")("root-files,f", bpo::value<std::vector<std::string>>()->multitoken(), "ROOT files from MCStepLogger to be merged (required)")("output-file,o", bpo::value<std::string>(), "merged output file (required)");
+    cmdFunction = merge;
   }
 }
 
@@ -158,7 +246,7 @@ int main(int argc, char* argv[])
   bpo::variables_map vm;
   // Description of the available top-level commands/options
   bpo::options_description desc("Available commands/options");
-  desc.add_options()("help,h", "show this help message and exit")("command", bpo::value<std::string>(), "command to be executed (\"analyze\", \"checkFile\"")("positional", bpo::value<std::vector<std::string>>(), "positional arguments");
+  desc.add_options()("help,h", "show this help message and exit")("command", bpo::value<std::string>(), "command to be executed (\"analyze\", \"stream\", \"checkFile\", \"benchmark\", \"merge\"")("positional", bpo::value<std::vector<std::string>>(), "positional arguments");
   // Dedicated description for positional arguments
   bpo::positional_options_description pos;
   // First positional argument is actually the command, all others are real positional arguments "( "positional", -1 )"
@@ -0,0 +1,282 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+
+/*
+ * round trip of events through the binary step format
+ *
+ * A few events with steps, field calls, tracks and lookups are written with
+ * BinaryStepWriter and read back with BinaryStepReader, uncompressed, with
+ * float16 energies and compressed. Everything except the float16 energies has
+ * to come back bit by bit. A truncated file must not be read beyond its end.
+ *
+ * Basic usage
+ * $> binaryStepFormatCI
+ */
+
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE BinaryStepFormatTest
+#include <boost/test/unit_test.hpp>
+
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "MCStepLogger/BinaryStepFormat.h"
+
+using namespace o2;
+
+namespace
+{
+
+// everything written for one event, the secondary processes are owned here
+struct TestEvent {
+  EventHeader header;
+  std::vector<StepInfo> steps;
+  std::vector<MagCallInfo> calls;
+  std::vector<TrackInfo> tracks;
+  StepLookups lookups;
+  std::vector<std::vector<int>> secondaryprocesses;
+};
+
+std::vector<TestEvent> makeEvents(int nEvents)
+{
+  std::mt19937 rng(42);
+  std::vector<TestEvent> events(nEvents);
+  for (int ev = 0; ev < nEvents; ++ev) {
+    auto& event = events[ev];
+    event.header.eventid = ev;
+    event.header.workerid = 3;
+    event.header.chunk = 0;
+    event.header.lastchunk = true;
+    const int nTracks = 20 + 10 * ev;
+    const int nStepsPerTrack = 30;
+    // the secondary processes of a step point into this storage, it must not be reallocated
+    event.secondaryprocesses.reserve(nTracks * nStepsPerTrack);
+    for (int t = 0; t < nTracks; ++t) {
+      event.lookups.insertPDG(t, t % 2 ? 11 : -211);
+      event.lookups.insertParent(t, t - 1);
+      float x = rng() % 100, y = rng() % 100, z = rng() % 100, E = 10.f;
+      for (int k = 0; k < nStepsPerTrack; ++k) {
+        StepInfo step;
+        step.stepid = event.steps.size();
+        step.trackID = t;
+        step.volId = rng() % 50;
+        step.copyNo = rng() % 3;
+        x += 0.1f * (rng() % 10);
+        y += 0.01f;
+        z -= 0.3f;
+        E *= 0.97f;
+        step.x = x;
+        step.y = y;
+        step.z = z;
+        step.E = E;
+        step.step = 0.1f * (rng() % 100);
+        step.maxstep = 1e10;
+        step.nsecondaries = rng() % 3;
+        event.secondaryprocesses.emplace_back();
+        for (int i = 0; i < step.nsecondaries; ++i) {
+          event.secondaryprocesses.back().push_back(rng() % 40);
+        }
+        step.secondaryprocesses = step.nsecondaries > 0 ? event.secondaryprocesses.back().data() : nullptr;
+        step.nprocessesactive = rng() % 8;
+        step.stopped = k == nStepsPerTrack - 1;
+        step.weight = ev == 1 ? 4.f : 1.f;
+        step.firstprocess = rng() % 10;
+        step.cputime = 1e-6f * (rng() % 100);
+        event.lookups.insertVolName(step.volId, "vol" + std::to_string(step.volId));
+        event.lookups.insertMaterialName(step.volId, "mat" + std::to_string(step.volId % 7));
+        if (step.volId % 5 == 0) {
+          event.lookups.insertModuleName(step.volId, "MOD" + std::to_string(step.volId / 10));
+        }
+        event.steps.push_back(step);
+        if (rng() % 2) {
+          MagCallInfo call;
+          call.id = event.calls.size();
+          call.stepid = step.stepid;
+          call.x = x;
+          call.y = y;
+          call.z = z;
+          call.B = 0.005f * (rng() % 200);
+          call.weight = step.weight;
+          call.calltime = 1e-7f * (rng() % 50);
+          event.calls.push_back(call);
+        }
+      }
+      TrackInfo track;
+      track.trackID = t;
+      track.pdg = t % 2 ? 11 : -211;
+      track.parent = t - 1;
+      track.primary = 0;
+      track.x = 1.5f * t;
+      track.E = 10.f;
+      track.nsteps = nStepsPerTrack;
+      track.length = 0.25f * t;
+      event.tracks.push_back(track);
+    }
+  }
+  return events;
+}
+
+void writeEvents(const std::string& path, const std::vector<TestEvent>& events, bool float16Energy, int compression)
+{
+  BinaryStepWriter writer;
+  BOOST_REQUIRE(writer.open(path, float16Energy, compression));
+  for (auto& event : events) {
+    writer.writeEvent(event.header, event.steps, event.calls, event.lookups, &event.tracks);
+  }
+  writer.close();
+}
+
+std::string nameOrEmpty(const std::vector<std::string*>& names, int volId)
+{
+  return volId < names.size() && names[volId] ? *names[volId] : "";
+}
+
+void checkRoundTrip(const std::string& path, bool float16Energy, int compression)
+{
+  auto events = makeEvents(3);
+  writeEvents(path, events, float16Energy, compression);
+
+  BOOST_REQUIRE(BinaryStepReader::isBinaryFile(path));
+  BinaryStepReader reader;
+  BOOST_REQUIRE(reader.open(path));
+  BOOST_TEST(reader.nEvents() == events.size());
+
+  std::vector<StepInfo> steps;
+  std::vector<MagCallInfo> calls;
+  std::vector<TrackInfo> tracks;
+  StepLookups lookups;
+  EventHeader header;
+  for (auto& event : events) {
+    BOOST_REQUIRE(reader.readNextEvent(steps, calls, lookups, &header, &tracks));
+    BOOST_TEST(header.eventid == event.header.eventid);
+    BOOST_TEST(header.workerid == event.header.workerid);
+    BOOST_TEST(header.chunk == event.header.chunk);
+    BOOST_TEST(header.lastchunk == event.header.lastchunk);
+
+    BOOST_REQUIRE(steps.size() == event.steps.size());
+    for (std::size_t i = 0; i < steps.size(); ++i) {
+      auto& read = steps[i];
+      auto& written = event.steps[i];
+      BOOST_TEST(read.stepid == written.stepid);
+      BOOST_TEST(read.volId == written.volId);
+      BOOST_TEST(read.copyNo == written.copyNo);
+      BOOST_TEST(read.trackID == written.trackID);
+      BOOST_TEST(read.x == written.x);
+      BOOST_TEST(read.y == written.y);
+      BOOST_TEST(read.z == written.z);
+      if (float16Energy) {
+        BOOST_TEST(std::abs(read.E - written.E) <= 1e-3 * written.E);
+      } else {
+        BOOST_TEST(read.E == written.E);
+      }
+      BOOST_TEST(read.step == written.step);
+      BOOST_TEST(read.maxstep == written.maxstep);
+      BOOST_TEST(read.nprocessesactive == written.nprocessesactive);
+      BOOST_TEST(read.stopped == written.stopped);
+      BOOST_TEST(read.weight == written.weight);
+      BOOST_TEST(read.firstprocess == written.firstprocess);
+      BOOST_TEST(read.cputime == written.cputime);
+      BOOST_REQUIRE(read.nsecondaries == written.nsecondaries);
+      for (int k = 0; k < read.nsecondaries; ++k) {
+        BOOST_TEST(read.secondaryprocesses[k] == written.secondaryprocesses[k]);
+      }
+      BOOST_TEST(nameOrEmpty(lookups.volidtovolname, read.volId) == nameOrEmpty(event.lookups.volidtovolname, read.volId));
+      BOOST_TEST(nameOrEmpty(lookups.volidtomodule, read.volId) == nameOrEmpty(event.lookups.volidtomodule, read.volId));
+      BOOST_TEST(nameOrEmpty(lookups.volidtomaterial, read.volId) == nameOrEmpty(event.lookups.volidtomaterial, read.volId));
+    }
+
+    BOOST_REQUIRE(calls.size() == event.calls.size());
+    for (std::size_t i = 0; i < calls.size(); ++i) {
+      BOOST_TEST(calls[i].id == event.calls[i].id);
+      BOOST_TEST(calls[i].stepid == event.calls[i].stepid);
+      BOOST_TEST(calls[i].x == event.calls[i].x);
+      BOOST_TEST(calls[i].y == event.calls[i].y);
+      BOOST_TEST(calls[i].z == event.calls[i].z);
+      BOOST_TEST(calls[i].B == event.calls[i].B);
+      BOOST_TEST(calls[i].weight == event.calls[i].weight);
+      BOOST_TEST(calls[i].calltime == event.calls[i].calltime);
+    }
+
+    BOOST_REQUIRE(tracks.size() == event.tracks.size());
+    for (std::size_t i = 0; i < tracks.size(); ++i) {
+      BOOST_TEST(tracks[i].trackID == event.tracks[i].trackID);
+      BOOST_TEST(tracks[i].pdg == event.tracks[i].pdg);
+      BOOST_TEST(tracks[i].parent == event.tracks[i].parent);
+      BOOST_TEST(tracks[i].primary == event.tracks[i].primary);
+      BOOST_TEST(tracks[i].x == event.tracks[i].x);
+      BOOST_TEST(tracks[i].E == event.tracks[i].E);
+      BOOST_TEST(tracks[i].nsteps == event.tracks[i].nsteps);
+      BOOST_TEST(tracks[i].length == event.tracks[i].length);
+    }
+    BOOST_TEST(lookups.tracktopdg == event.lookups.tracktopdg);
+    BOOST_TEST(lookups.tracktoparent == event.lookups.tracktoparent);
+  }
+  BOOST_TEST(!reader.readNextEvent(steps, calls, lookups));
+  reader.close();
+  std::remove(path.c_str());
+}
+} // namespace
+
+BOOST_AUTO_TEST_CASE(round_trip_uncompressed)
+{
+  checkRoundTrip("binaryStepFormatCI_plain.bin", false, 0);
+}
+
+BOOST_AUTO_TEST_CASE(round_trip_float16_energy)
+{
+  checkRoundTrip("binaryStepFormatCI_float16.bin", true, 0);
+}
+
+BOOST_AUTO_TEST_CASE(round_trip_compressed)
+{
+  // the default (zstd) and zlib
+  checkRoundTrip("binaryStepFormatCI_default.bin", false, -1);
+  checkRoundTrip("binaryStepFormatCI_zlib.bin", false, 101);
+}
+
+BOOST_AUTO_TEST_CASE(truncated_file)
+{
+  const std::string path = "binaryStepFormatCI_truncated.bin";
+  auto events = makeEvents(3);
+  for (int compression : { 0, -1 }) {
+    writeEvents(path, events, false, compression);
+    // cut the file in the middle of the last event
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    BOOST_REQUIRE(file != nullptr);
+    std::vector<char> content(1 << 24);
+    content.resize(std::fread(content.data(), 1, content.size(), file));
+    std::fclose(file);
+    BOOST_REQUIRE(content.size() > 100);
+    file = std::fopen(path.c_str(), "wb");
+    std::fwrite(content.data(), 1, content.size() - 100, file);
+    std::fclose(file);
+
+    // complete events are still read, the truncated one is not
+    BinaryStepReader reader;
+    std::vector<StepInfo> steps;
+    std::vector<MagCallInfo> calls;
+    StepLookups lookups;
+    int nRead = 0;
+    if (reader.open(path)) {
+      while (reader.readNextEvent(steps, calls, lookups)) {
+        BOOST_REQUIRE(nRead < events.size());
+        BOOST_TEST(steps.size() == events[nRead].steps.size());
+        ++nRead;
+      }
+    }
+    BOOST_TEST(nRead < events.size());
+    reader.close();
+  }
+  std::remove(path.c_str());
+}
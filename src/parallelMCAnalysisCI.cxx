@@ -0,0 +1,237 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+
+/*
+ * comparison of a parallel and a sequential analysis of the same MCStepLogger file
+ *
+ * The test consists of 2 cases which are run separately (see CMakeLists.txt):
+ * 1. write_steplogger_file writes a small synthetic MCStepLogger ROOT file with
+ *    a StepLoggerIndex. One of its events is split into 2 chunks which are
+ *    interleaved with an event of another worker.
+ * 2. compare_analyses compares the histograms of BasicMCAnalysis obtained from
+ *    that file by
+ *    $> mcStepAnalysis analyze -f <file> -o <dir1> -l test -j 1
+ *    $> mcStepAnalysis analyze -f <file> -o <dir2> -l test -j 4
+ *    Entries and bin contents have to agree, labelled bins are matched by their
+ *    label since their order may differ.
+ *
+ * Basic usage
+ * $> parallelMCAnalysisCI --run_test=write_steplogger_file -- <path/to/MCStepLoggerOutput.root>
+ * $> parallelMCAnalysisCI --run_test=compare_analyses -- <path/to/sequential/Analysis.root> <path/to/parallel/Analysis.root>
+ */
+
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE ParallelMCAnalysisTest
+#include <boost/test/unit_test.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "TFile.h"
+#include "TTree.h"
+#include "TH1.h"
+
+#include "MCStepLogger/StepInfo.h"
+#include "MCStepLogger/StepLoggerIndex.h"
+#include "MCStepLogger/MetaInfo.h"
+#include "MCStepLogger/MCAnalysisFileWrapper.h"
+
+using namespace o2::mcstepanalysis;
+
+namespace
+{
+
+// the containers of one tree entry, the secondary processes are owned here
+struct TestChunk {
+  o2::EventHeader header;
+  std::vector<o2::StepInfo> steps;
+  std::vector<o2::MagCallInfo> calls;
+  o2::StepLookups lookups;
+  std::vector<std::vector<int>> secondaryprocesses;
+};
+
+// steps of nTracks tracks, step and field call ids start at firstStepId and firstCallId
+void fillChunk(TestChunk& chunk, std::mt19937& rng, int nTracks, int firstStepId, long firstCallId)
+{
+  const int pdgs[] = { 11, -11, 22, 211, 2212 };
+  const int nStepsPerTrack = 5 + rng() % 40;
+  chunk.secondaryprocesses.reserve(nTracks * nStepsPerTrack);
+  int stepId = firstStepId;
+  long callId = firstCallId;
+  for (int t = 0; t < nTracks; ++t) {
+    chunk.lookups.insertPDG(t, pdgs[t % 5]);
+    chunk.lookups.insertParent(t, t - 1);
+    float x = -100.f + rng() % 200, y = -10.f + rng() % 20, z = -10.f + rng() % 20, E = 10.f;
+    for (int k = 0; k < nStepsPerTrack; ++k) {
+      o2::StepInfo step;
+      step.stepid = stepId++;
+      step.trackID = t;
+      step.volId = rng() % 40;
+      x += 0.5f * (rng() % 10);
+      y += 0.1f;
+      z -= 0.1f;
+      E *= 0.95f;
+      step.x = x;
+      step.y = y;
+      step.z = z;
+      step.E = E;
+      step.step = 0.5f * (rng() % 100);
+      step.nsecondaries = rng() % 3;
+      chunk.secondaryprocesses.emplace_back(step.nsecondaries, 1 + rng() % 40);
+      step.secondaryprocesses = step.nsecondaries > 0 ? chunk.secondaryprocesses.back().data() : nullptr;
+      step.stopped = k == nStepsPerTrack - 1;
+      chunk.lookups.insertVolName(step.volId, "vol" + std::to_string(step.volId));
+      chunk.lookups.insertModuleName(step.volId, "MOD" + std::to_string(step.volId / 10));
+      chunk.lookups.insertMediumName(step.volId, "med" + std::to_string(step.volId % 4));
+      chunk.lookups.insertMaterialName(step.volId, "mat" + std::to_string(step.volId % 7));
+      chunk.steps.push_back(step);
+      for (int c = rng() % 3; c > 0; --c) {
+        o2::MagCallInfo call;
+        call.id = callId++;
+        call.stepid = step.stepid;
+        call.x = x;
+        call.y = y;
+        call.z = z;
+        call.B = 0.001f * (rng() % 100);
+        chunk.calls.push_back(call);
+      }
+    }
+  }
+}
+} // namespace
+
+BOOST_AUTO_TEST_CASE(write_steplogger_file)
+{
+  // the path of the file to be written
+  BOOST_REQUIRE(boost::unit_test::framework::master_test_suite().argc == 2);
+  std::mt19937 rng(7);
+
+  // events of different sizes, the second event of worker 1 is split into 2 chunks
+  // and the first event of worker 0 is written in between
+  std::vector<TestChunk> chunks(13);
+  int eventId = 0;
+  for (std::size_t i = 0; i < chunks.size(); ++i) {
+    auto& chunk = chunks[i];
+    chunk.header.workerid = i % 2;
+    if (i == 3) {
+      // the last chunk of the event started in entry 1
+      chunk.header = chunks[1].header;
+      chunk.header.chunk = 1;
+      chunk.header.lastchunk = true;
+      fillChunk(chunk, rng, 5, chunks[1].steps.size(), chunks[1].calls.size());
+      continue;
+    }
+    chunk.header.eventid = eventId++;
+    chunk.header.lastchunk = i != 1;
+    fillChunk(chunk, rng, 5 + rng() % 30, 0, 0);
+  }
+
+  TFile file(boost::unit_test::framework::master_test_suite().argv[1], "RECREATE");
+  BOOST_REQUIRE(!file.IsZombie());
+  // owned by the file
+  auto tree = new TTree(defaults::defaultStepLoggerTTreeName.c_str(), "synthetic MCStepLogger output");
+  auto header = &chunks[0].header;
+  auto steps = &chunks[0].steps;
+  auto calls = &chunks[0].calls;
+  auto lookups = &chunks[0].lookups;
+  tree->Branch("Header", &header);
+  tree->Branch("Steps", &steps);
+  tree->Branch("Calls", &calls);
+  tree->Branch("Lookups", &lookups);
+  o2::StepLoggerIndex index;
+  for (std::size_t i = 0; i < chunks.size(); ++i) {
+    header = &chunks[i].header;
+    steps = &chunks[i].steps;
+    calls = &chunks[i].calls;
+    lookups = &chunks[i].lookups;
+    tree->Fill();
+    o2::EventIndexEntry entry;
+    entry.entry = i;
+    entry.eventid = header->eventid;
+    entry.workerid = header->workerid;
+    entry.chunk = header->chunk;
+    entry.lastchunk = header->lastchunk;
+    entry.nsteps = steps->size();
+    entry.ncalls = calls->size();
+    index.entries.push_back(entry);
+  }
+  tree->Write();
+  file.WriteObject(&index, "StepLoggerIndex");
+  file.Close();
+}
+
+BOOST_AUTO_TEST_CASE(compare_analyses)
+{
+  // the analysis files of a sequential and a parallel run
+  BOOST_REQUIRE(boost::unit_test::framework::master_test_suite().argc == 3);
+  MCAnalysisFileWrapper sequential;
+  MCAnalysisFileWrapper parallel;
+  BOOST_REQUIRE(sequential.read(boost::unit_test::framework::master_test_suite().argv[1]));
+  BOOST_REQUIRE(parallel.read(boost::unit_test::framework::master_test_suite().argv[2]));
+
+  const std::vector<std::string> names = { "nEvents", "nTracks", "nTracksPerEvent", "nTracksPerPDGPerEvent", "relNTracksPerPDGPerEvent",
+                                           "nSteps", "nStepsPerEvent", "nStepsPerVolPerEvent", "relNStepsPerVolPerEvent",
+                                           "nStepPerMod", "nStepPerMed", "nStepPerMat", "nStepsPerPDGPerEvent", "relNStepsPerPDGPerEvent",
+                                           "stepsXPerEvent", "stepsYPerEvent", "stepsZPerEvent", "meanStepSizePerEvent",
+                                           "meanStepSizePerVolPerEvent", "meanStepSizePerPDGPerEvent", "stepSizesPerEvent", "RZOccupancy",
+                                           "stepsEnergyPerEvent", "nSecondariesPerEvent", "nSecondariesPerVolPerEvent",
+                                           "magFieldCallsPerVolPerEvent", "smallMagFieldCallsPerVolPerEvent", "nVolumes" };
+  // contents are summed up in a different order
+  const double tolerance = 1e-5;
+  auto isClose = [tolerance](double a, double b) { return std::abs(a - b) <= tolerance * std::max(std::abs(a), std::abs(b)); };
+
+  for (auto& name : names) {
+    BOOST_TEST_CONTEXT("histogram " << name)
+    {
+      BOOST_REQUIRE(sequential.hasHistogram(name));
+      BOOST_REQUIRE(parallel.hasHistogram(name));
+      TH1& seq = sequential.getHistogram(name);
+      TH1& par = parallel.getHistogram(name);
+      BOOST_TEST(isClose(seq.GetEntries(), par.GetEntries()), seq.GetEntries() << " != " << par.GetEntries());
+      BOOST_TEST(seq.GetEntries() > 0.);
+      // alphanumeric bins are matched by their label
+      if (seq.GetXaxis()->GetLabels()) {
+        BOOST_REQUIRE(par.GetXaxis()->GetLabels());
+        int nLabels = 0;
+        for (int i = 1; i <= seq.GetNbinsX(); ++i) {
+          const char* label = seq.GetXaxis()->GetBinLabel(i);
+          if (std::string(label).empty()) {
+            continue;
+          }
+          ++nLabels;
+          const int j = par.GetXaxis()->FindFixBin(label);
+          BOOST_TEST_CONTEXT("bin " << label)
+          {
+            BOOST_REQUIRE(j > 0);
+            BOOST_TEST(isClose(seq.GetBinContent(i), par.GetBinContent(j)), seq.GetBinContent(i) << " != " << par.GetBinContent(j));
+          }
+        }
+        for (int j = 1; j <= par.GetNbinsX(); ++j) {
+          if (!std::string(par.GetXaxis()->GetBinLabel(j)).empty()) {
+            --nLabels;
+          }
+        }
+        BOOST_TEST(nLabels == 0);
+        continue;
+      }
+      BOOST_REQUIRE(seq.GetNcells() == par.GetNcells());
+      for (int i = 0; i < seq.GetNcells(); ++i) {
+        BOOST_TEST_CONTEXT("bin " << i)
+        {
+          BOOST_TEST(isClose(seq.GetBinContent(i), par.GetBinContent(i)), seq.GetBinContent(i) << " != " << par.GetBinContent(i));
+        }
+      }
+    }
+  }
+}